@@ -1,4 +1,8 @@
 /*-------------------- includes -------------------------*/ 
+#define _DEFAULT_SOURCE                                //getline、strdup、mmap等需要的特性宏
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ctype.h>
 #include <unistd.h>
@@ -6,16 +10,52 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*-------------------- defines --------------------------*/
 #define CTRL_KEY(k) ((k) & 0x1f)                       //重构Ctrl组合键(Ctrl+字母 ASCII为1-26)
 #define VERSION "0.0.1"
 #define TAB_STOP 8
+#define HASH_INIT 14695981039346656037ULL             //FNV-1a哈希初值
+#define INDEX_MAGIC "L3IDX02"                          //行索引缓存文件的标识
+#define INDEX_STEP 4096                                //每隔多少行记录一个检查点
+#define INDEX_CHUNK (16 << 20)                         //空闲时每次扫描的字节数
+#define HEX_WIDTH 16                                   //十六进制视图每行显示的字节数
+#define BINARY_PROBE 8192                              //检查文件开头多少字节来判断是否为二进制文件
+#define ROW_CACHE 4096                                 //映射文件最多同时载入多少行的内容
+#define MAX_THREADS 64
+#define TABLE_CACHE 1024                               //表格模式缓存多少行的字段偏移，须大于屏幕行数
+#define TABLE_SAMPLE 256                               //打开表格模式时抽样多少行估计列宽
+#define TABLE_MAXW 40                                  //单列最大显示宽度
+#define TABLE_FROZEN 1                                 //左侧固定不随横向滚动的列数
+#define DIFF_WINDOW (1 << 18)                          //每次比较的最大行数，决定比较线程的内存上限
+#define DIFF_MIN_COST 1024                             //一次找中间蛇最多走多少步，超过后用近似的分割点
+#define DIFF_REFRESH 200                               //比较进行中刷新屏幕的间隔（毫秒）
+#define JOB_TICK 65536                                 //排序/过滤线程每处理多少行报告一次进度并检查是否取消，须为2的幂
+#define JOB_REFRESH 200                                //排序/过滤进行中刷新进度的间隔（毫秒）
+#define ESC_WAIT 100                                   //读到Esc后等待转义序列后续字符的时间（毫秒）
+#define SOCKET_NAME "level3.sock"                      //服务器模式监听的Unix套接字文件名
+#define MSG_MAX 4096                                   //客户端消息的最大长度
+#define INDEX_CACHE_MIN (1 << 20)                      //小于1MB的文件不写缓存，直接扫描更快
+#define INDEX_TAIL 4096                                //判断文件是否只是追加时校验的尾部长度
 enum editorKey {
+  BACKSPACE = 127,
   ARROW_LEFT = 1000,                                   //为了防止冲突，设一个很大的键值
   ARROW_RIGHT,
   ARROW_UP,
@@ -30,27 +70,112 @@ enum editorKey {
 typedef struct erow {                                  //保存文本编辑器的一行
   int size;
   int rsize;
-  char *chars;
+  char *chars;                                         //为NULL表示还未从文件映射中载入
   char *render;
 } erow;
 
+struct fieldIndex {                                    //表格模式下一行的字段偏移
+  int row;                                             //文件行号，-1表示空
+  int n;                                               //字段数
+  int cap;
+  int *off;                                            //第k个字段从off[k]开始，off[n]为行长加一
+};
+
+struct lineIndexHeader {                               //行索引缓存文件头，后面紧跟nckpt个检查点偏移
+  char magic[8];
+  uint64_t pathhash;
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_nsec;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t tailhash;                                   //文件末尾INDEX_TAIL字节的哈希
+  uint64_t numrows;
+  uint64_t nckpt;
+};
+
+
+struct abuf {                                          //缓冲区结构体
+  char *b;
+  int len;
+};
+
+struct editorBuffer {                                  //文件内容、行索引和渲染缓存，服务器模式下由查看同一文件的客户端共享
+    char *filename;
+    int numrows;
+    erow *row;                                         //映射文件：按行号取模的行缓存；管道：全部行
+    int *rowno;                                        //行缓存每个槽位存放的行号，-1表示空
+    char *map;                                         //只读映射的文件内容
+    size_t mapsize;
+    struct stat filestat;
+    uint64_t indexed;                                  //已建立索引的字节数，小于mapsize表示还在索引
+    uint64_t *ckpt;                                    //稀疏索引：第k*INDEX_STEP行的起始偏移
+    int nckpt;
+    int ckptcap;
+    uint64_t blk[INDEX_STEP + 1];                      //最近用到的一段检查点区间内每行的起始偏移
+    int blkno;
+    int blkrows;
+    int hexdigits;                                     //十六进制视图中偏移列的宽度
+    int binary;                                        //打开时判断为二进制文件
+    char delim;                                        //按扩展名判断的分隔符，0表示不是表格文件
+    pthread_mutex_t lock;                              //客户端线程除了等待按键的时候都持有这把锁
+    int clients;                                       //正在查看的客户端数，与shared一起由buffers_lock保护
+    int shared;                                        //是否还在服务器的缓冲区列表中
+    struct editorBuffer *next;
+};
 
-struct editorConfig {                                  //设置全局结构体
+struct editorConfig {                                  //设置全局结构体，服务器模式下每个客户端线程各有一份
     int cx, cy;
     int rx;
     int rowoff;
     int coloff;
     int screenrows;
     int screencols;
-    int numrows;
-    erow *row;
-    char *filename;
+    struct editorBuffer *buf;
+    int wrap;                                          //软换行模式
+    int wrapoff;                                       //软换行时顶部行已滚过的屏幕行数
+    int wrapcy, wrapcx;                                //软换行时光标在屏幕上的位置
+    int wraprows;                                      //下面几个数组已覆盖的行数
+    int wrapcap;
+    int *wrapcnt;                                      //每行占用的屏幕行数（未计算的按1估计）
+    int *wrapgen;                                      //计算wrapcnt时的代数，与wrapgeneration不同则需重算
+    int wrapgeneration;                                //窗口宽度变化时加一，旧的换行结果随之失效
+    int64_t *fen;                                      //wrapcnt的树状数组，用于屏幕行与文件行互相换算
+    int hex;                                           //十六进制视图，直接从文件映射中读取
+    uint64_t hexoff;                                   //顶部显示的是第几行（每行HEX_WIDTH字节）
+    uint64_t hexcur;                                   //光标所在的字节偏移
+    int table;                                         //按列对齐显示CSV/TSV
+    char delim;
+    int tcol;                                          //光标所在列
+    int tcoloff;                                       //固定列右边显示的第一列
+    int tablecx;                                       //光标所在列在屏幕上的位置
+    int *colw;                                         //每列的显示宽度，只会变宽
+    int ncols;                                         //见过的最大字段数
+    int colcap;
+    int sampled;                                       //是否已抽样估计过列宽
+    struct fieldIndex *fields;                         //按文件行号直接映射的字段偏移缓存
+    struct editorDiff *diff;                           //并排比较两个文件，左边是buf
+    struct viewJob *job;                               //后台进行中的排序/过滤
+    int *view;                                         //排序/过滤后显示的文件行号，NULL表示按原顺序显示全部行
+    int nview;
+    int anchored;                                      //跳到了还没索引到的位置，按偏移显示，行号暂时未知
+    uint64_t anchor;                                   //此时顶部行的起始偏移，cy是相对它的屏幕行
     char statusmsg[80];
     time_t statusmsg_time;
     struct termios orig_termios;
+    int client;                                        //服务器中为某个客户端服务
+    int infd, outfd;                                   //按键来源和画面输出
+    int locked;                                        //当前线程是否持有buf->lock
+    char inq[MSG_MAX];                                 //客户端发来还没处理的按键
+    int inqlen, inqpos;
+    struct abuf *frame;                                //上一次发给客户端的画面，按行保存，用于只发送变化的行
+    int framerows;
 };
 
-struct editorConfig E;
+__thread struct editorConfig E;
+volatile sig_atomic_t winchanged = 0;                  //收到SIGWINCH后置1
+struct editorBuffer *buffers = NULL;                   //服务器中常驻的缓冲区
+pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*-------------------- terminal -------------------------*/
 void enableRawMode();                                  //启用原始模式
@@ -58,22 +183,123 @@ void disableRawMode();                                 //关闭原始模式
 int editorReadKey();                                   //按键读取函数
 void die(const char *s);                               //报错处理
 int getWindowSize(int *rows, int *cols);               //设置窗口大小（从<sys/ioctl.h>中获取）
+void handleSigWinCh(int unused);                       //窗口大小改变的信号处理
+void editorResize();                                   //重新读取窗口大小
+void editorSetSize(int rows, int cols);                //按终端的行列数设置显示区域
+int editorReadInput(char *c);                          //读一个字节：1成功，-1出错（errno为EINTR表示窗口变化）
+int editorInputPending();                              //是否有尚未处理的输入
+int editorWaitInput(int ms);                           //最多等待ms毫秒的输入，期间让出缓冲区锁
+void editorWrite(const char *s, int len);              //向终端（或客户端）写出全部内容
+void editorQuit();                                     //Ctrl-Q：独立运行时退出，服务器中断开客户端
 
 /*--------------------row operation----------------------*/
 void editorAppendRow(char *s, size_t len);
 void editorUpdateRow(erow *row);
 int editorRowCxToRx(erow *row, int cx);
+int editorRowRxToCx(erow *row, int rx);
+erow *editorRowAt(int at);                             //取显示的第at行
+erow *editorFileRow(int filerow);                      //取文件的第filerow行，必要时从文件映射中载入
+int editorNumRows();                                   //显示的行数
+int editorViewRow(int at);                             //显示的第at行对应的文件行
 
 /*--------------------- file i/o ------------------------*/
 
 void editorOpen(char *filename);
+struct editorBuffer *editorNewBuffer();
+void editorFreeBuffer(struct editorBuffer *b);
 
-/*-------------------- append buffer --------------------*/
-struct abuf {                                          //缓冲区结构体
-  char *b;
-  int len;
+/*--------------------- line index ----------------------*/
+uint64_t editorHash(const char *s, size_t len, uint64_t h);   //FNV-1a哈希
+void editorIndexStep(uint64_t upto);                   //继续建立索引，直到扫描到偏移upto或文件末尾
+void editorIndexUntilRow(int at);                      //保证第at行已被索引
+void editorRowBounds(int at, uint64_t *start, uint64_t *end);  //借助检查点求第at行的范围
+int editorRowFromOffset(uint64_t off);                 //求偏移off所在的行，离已索引的位置太远时返回-1
+int editorIndexLoad(const char *filename, struct stat *st);   //载入缓存，0命中，1需继续扫描，-1失效
+void editorIndexAdopt(uint64_t *spans, int n);         //用排序/过滤时数出的全部行首直接完成索引
+void editorIndexSave(const char *filename, struct stat *st);
+char *editorIndexCachePath(const char *filename);
+
+/*--------------------- soft wrap -----------------------*/
+void editorToggleWrap();
+void editorWrapSync();                                 //让换行缓存覆盖新索引到的行
+int editorWrapRow(int at);                             //第at行占用的屏幕行数，过期时重新计算
+void editorWrapUpdate(int at);                         //行内容或宽度变化后更新第at行
+void editorWrapAround(int at);                         //精确计算第at行附近一屏范围内的行
+void editorWrapScroll();
+void editorWrapPage(int delta);                        //软换行模式下按屏幕行翻页
+void editorFenAdd(int at, int64_t delta);
+int64_t editorFenPrefix(int n);                        //前n行共占用的屏幕行数
+int editorFenFind(int64_t line, int *seg);             //第line个屏幕行所在的文件行及其中第几段
+
+/*------------------- sort & filter ---------------------*/
+struct rowSource {                                     //工作线程读取行内容所需的全部数据（E是线程局部的）
+  struct editorBuffer *buf;
+  uint64_t *spans;                                     //每个文件行的起始偏移，spans[numrows]为文件末尾
+  int desc;
+};
+
+struct viewJob {                                       //后台进行的排序/过滤，UI线程定时查看进度，按Esc取消
+  pthread_mutex_t lock;                                //保护stage、work、total、cancel和done
+  pthread_t tid;
+  int created;
+  const char *stage;                                   //正在进行的步骤
+  int64_t work, total;                                 //这一步已完成的和总的工作量
+  int cancel;
+  int done;
+  const char *error;                                   //出错时的提示
+  int filter;                                          //1为过滤，0为排序
+  struct rowSource rs;
+  int rows;                                            //文件行数，有映射时由线程重新数出
+  int spansok;                                         //rs.spans已经完整
+  int *src;                                            //开始时显示的行号，NULL表示按文件顺序的全部行
+  int n;
+  int first, last;                                     //排序范围[first,last)，last为-1表示到最后
+  char *query;
+  int *result;
+  int nresult;
 };
 
+struct rowJob {                                        //排序/过滤线程的参数，各线程只读行内容
+  struct rowSource *rs;
+  struct viewJob *vj;
+  uint64_t from, to;                                   //求行首时负责的字节范围
+  int64_t lines;                                       //这一段的行数，第二遍时为这一段第一行的行号
+  int *src;
+  int *dst;
+  int *tmp;
+  int lo, hi;                                          //本线程负责的区间
+  int alo, ahi, blo, bhi;                              //归并时的两段输入
+  const char *pattern;
+  size_t patlen;
+  int invert;
+  int count;
+};
+
+void editorSortRows();                                 //对全部或指定范围的行排序，只移动行号
+void editorFilterRows();                               //只显示包含（或不包含）某字符串的行
+void editorResetView();                                //恢复按文件顺序显示全部行
+int editorThreads();                                   //可用的CPU数
+void editorRunWorkers(void *(*fn)(void *), struct rowJob *job, int nt);   //每个job一个线程，等全部结束
+int editorJobTick(struct viewJob *vj, int64_t work);   //报告进度，返回是否已被取消
+int editorJobStage(struct viewJob *vj, const char *stage, int64_t total);
+void editorJobStart(struct viewJob *vj);               //在后台线程中排序/过滤当前显示的行
+void editorJobSort(struct viewJob *vj);
+void editorJobFilter(struct viewJob *vj);
+void *editorJobWorker(void *arg);
+int editorJobPoll();                                   //任务已结束时换上结果并返回1
+void editorJobCancel();
+void editorJobStop();                                  //取消并等待任务结束
+int editorJobBusy();                                   //有任务在进行时提示并返回1
+uint64_t *editorBuildSpans(struct viewJob *vj);        //并行扫描文件映射求出每行的起始偏移，供线程读取行内容
+const char *editorSpan(struct rowSource *rs, int filerow, int *len);   //线程安全地取行内容
+int editorRowCmp(struct rowSource *rs, int a, int b);
+int editorCoRank(struct rowSource *rs, int k, int *a, int m, int *b, int n);   //归并结果前k个中来自a的个数
+void *spanWorker(void *arg);
+void *sortWorker(void *arg);
+void *mergeWorker(void *arg);
+void *filterWorker(void *arg);
+
+/*-------------------- append buffer --------------------*/
 #define ABUF_INIT {NULL, 0}                             //abuf类型构造函数 
 
 void abAppend(struct abuf *ab, const char *s, int len);
@@ -87,9 +313,120 @@ void editorDrawStatusBar(struct abuf *ab);              //显示状态栏
 void editorSetStatusMessage(const char *fmt, ...);      //可变参数函数，用于生成状态栏信息
 void editorDrawMessageBar(struct abuf *ab);
 
+/*--------------------- offset view ---------------------*/
+void editorAnchorAt(uint64_t off);                     //跳到偏移off所在行，行号等空闲索引追上后再确定
+uint64_t editorAnchorNext(uint64_t pos);               //pos所在行的下一行起始偏移，没有则为mapsize
+uint64_t editorAnchorPrev(uint64_t pos);               //行首pos的上一行起始偏移
+uint64_t editorAnchorLine(int y);                      //屏幕第y行的起始偏移
+void editorAnchorRow(uint64_t pos, erow *row);         //把从pos开始的一行载入临时行，用完由调用者释放
+void editorAnchorScroll();
+void editorDrawAnchorRows(struct abuf *ab);
+int editorAnchorMoveCursor(int key);                   //处理了按键返回1
+
+/*--------------------- hex view ------------------------*/
+void editorToggleHex();
+void editorHexEncode(const unsigned char *src, char *dst);   //16字节编码为32个十六进制字符
+void editorHexAscii(const unsigned char *src, char *dst);    //16字节转为可打印字符，其余显示为'.'
+void editorDrawHexRows(struct abuf *ab);
+void editorHexScroll();
+int editorHexMoveCursor(int key);                      //处理了按键返回1
+int editorHexCursorCol();                              //光标在十六进制列中的屏幕列
+
+/*--------------------- table view ----------------------*/
+void editorToggleTable();
+char editorDetectDelim(const char *filename);         //按扩展名判断分隔符
+int editorSplitFields(const char *s, int len, char delim, int *off, int max);   //返回字段数，off需要n+1项
+int editorCellText(const char *s, int len, char delim, char *out, int w);       //单元格显示内容，返回完整宽度
+struct fieldIndex *editorRowFields(int filerow);       //取某行的字段偏移，必要时切分并加宽列
+void editorTableMeasure(const char *s, const int *off, int n);   //按一行的内容加宽各列
+void editorTableSample();
+void editorTableScroll();
+void editorDrawTableRows(struct abuf *ab);
+int editorTableMoveCursor(int key);                    //处理了按键返回1
+
+/*--------------------- diff view -----------------------*/
+enum diffKind {
+  DIFF_SAME,
+  DIFF_CHANGED,
+  DIFF_PENDING                                         //还没比较到
+};
+
+struct diffHunk {                                      //A中从a起的alen行换成了B中从b起的blen行
+  int a, alen;
+  int b, blen;
+  int row;                                             //对齐显示时从第几行开始
+};
+
+struct editorDiff {
+  struct editorBuffer *other;                          //右边的文件
+  const char *amap, *bmap;                             //比较线程只读文件映射，不碰E
+  size_t asize, bsize;
+  pthread_mutex_t lock;                                //保护下面的字段，比较线程只在提交结果时短暂持有
+  struct diffHunk *hunk;                               //按顺序排列，只会在末尾追加
+  int nhunk;
+  int hunkcap;
+  int n, m;                                            //两个文件的行数，比较线程读到文件末尾之前为-1
+  int fa, fb;                                          //A的前fa行与B的前fb行已经比较完
+  uint64_t abytes, bbytes;                             //比较完的部分的字节数，用于显示进度
+  int done;
+  int shown;                                           //界面上次画的是否已是完整结果，只由界面线程读写
+};
+
+struct diffSide {                                      //比较窗口中一个文件的行哈希
+  const char *map;
+  size_t size;
+  uint64_t pos;                                        //下一行的起始偏移
+  int next;                                            //下一行的行号
+  uint64_t *h;
+  uint64_t *o;                                         //窗口中每行的起始偏移
+  int len;                                             //窗口中的行数，第一行是next-len
+};
+
+struct diffWork {                                      //线性空间Myers算法的工作区
+  const uint64_t *xv, *yv;
+  int *fd, *bd;                                        //正向/反向每条对角线走到的x，可用负下标
+  int cost;
+  struct diffHunk *ed;                                 //本窗口的差异，窗口内的相对行号
+  int ned;
+  int edcap;
+};
+
+void editorDiffOpen(char *filename);                   //打开第二个文件并开始后台比较
+void *diffWorker(void *arg);
+uint64_t editorDiffHash(const char *map, uint64_t start, uint64_t end);   //行内容的哈希，不含换行符
+int editorDiffFill(struct diffSide *s);                //把窗口补满DIFF_WINDOW行，读到文件末尾时返回1
+int editorDiffCost(int diags);
+void editorDiffSplit(struct diffWork *w, int xoff, int xlim, int yoff, int ylim, int *xmid, int *ymid);   //找中间蛇
+void editorDiffCompare(struct diffWork *w, int xoff, int xlim, int yoff, int ylim);
+void editorDiffEdit(struct diffWork *w, int a, int alen, int b, int blen);
+void editorDiffAddHunk(struct editorDiff *d, int a, int alen, int b, int blen);   //调用时持有d->lock
+int editorDiffRows();                                  //对齐后的总行数
+int editorDiffLine(int r, int *la, int *lb);           //第r行左右两边的行号（-1为空），返回diffKind
+int editorDiffDone();
+void editorDiffScroll();
+void editorDrawDiffRows(struct abuf *ab);
+void editorDiffDrawSide(struct abuf *ab, struct editorBuffer *b, int line, int width, const char *color);
+int editorDiffMoveCursor(int key);                     //比较视图只能浏览，除Ctrl-Q外的按键都在这里处理
+void editorDiffJump(int dir);                          //跳到下一处/上一处差异
+
 /*--------------------- input ---------------------------*/
 void editorProcessKeypress();                          //重构功能
 void editorMoveCursor(int key);                        //重构光标移动键
+char *editorPrompt(char *prompt);                      //在消息栏中读取一行输入
+void editorGoto();                                     //跳转到行号、百分比或字节偏移
+
+/*--------------------- server --------------------------*/
+char *editorSocketPath();
+int editorPeerIsUser(int fd);                          //套接字另一端是否是当前用户的进程
+void editorServe();                                    //常驻运行，保留打开过的缓冲区
+void *editorServeClient(void *arg);                    //为一个客户端服务的线程
+struct editorBuffer *editorShareBuffer(const char *path);   //找到或打开文件对应的缓冲区
+struct editorBuffer *editorFindBuffer(const char *path, struct stat *st);   //持有buffers_lock时查找，同时移除过期的缓冲区
+void editorDetach();                                   //断开当前客户端并结束线程
+void editorFrameDiff(struct abuf *out, struct abuf *frame);  //只输出与上一帧不同的行
+int editorSendMessage(int fd, int type, const char *data, int len);
+int editorRecvMessage(int fd, int *type, char *data, int *len);
+int editorAttach(char *filename);                      //作为客户端连接服务器，没有服务器返回-1，不是自己的服务器返回-2
 
 
 /*---------------------- init ---------------------------*/
@@ -99,25 +436,79 @@ void initEditor() {
   E.rx = 0;
   E.rowoff = 0;
   E.coloff = 0;
-  E.numrows = 0;                                     //初始读取行数
-  E.row = NULL;
-  E.filename = NULL;
+  E.buf = E.client ? NULL : editorNewBuffer();       //客户端的缓冲区在收到文件名后再找
+  E.wrap = 0;
+  E.wrapoff = 0;
+  E.wrapcy = 0;
+  E.wrapcx = 0;
+  E.wraprows = 0;
+  E.wrapcap = 0;
+  E.wrapcnt = NULL;
+  E.wrapgen = NULL;
+  E.wrapgeneration = 0;
+  E.fen = NULL;
+  E.hex = 0;
+  E.hexoff = 0;
+  E.hexcur = 0;
+  E.table = 0;
+  E.delim = 0;
+  E.tcol = 0;
+  E.tcoloff = 0;
+  E.tablecx = 0;
+  E.colw = NULL;
+  E.ncols = 0;
+  E.colcap = 0;
+  E.sampled = 0;
+  E.fields = NULL;
+  E.diff = NULL;
+  E.view = NULL;
+  E.nview = 0;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
+  E.frame = NULL;
+  E.framerows = 0;
+  E.inqlen = 0;
+  E.inqpos = 0;
+  E.locked = 0;
+  if (!E.client) {
+    E.infd = STDIN_FILENO;
+    E.outfd = STDOUT_FILENO;
+  }
 
-  if (getWindowSize(&E.screenrows, &E.screencols) == -1) 
+  int rows = 24, cols = 80;                          //客户端的窗口大小由它自己发来
+  if (!E.client && getWindowSize(&rows, &cols) == -1)
   die("getWindowSize");                              //初始化屏幕大小
+  editorSetSize(rows, cols);
 }
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "--server") == 0)) {
+        editorServe();                                //服务器模式不接管终端
+        return 0;
+    }
     enableRawMode();
+
+    struct sigaction sa;                              //不设SA_RESTART，让阻塞的read被信号打断
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigWinCh;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    int attach = argc >= 3 && (strcmp(argv[1], "-a") == 0 || strcmp(argv[1], "--attach") == 0);
+    if (attach) {
+        attach = editorAttach(argv[2]);               //连接成功时不会返回
+        argv++;
+        argc--;
+    }
     initEditor();                           
     
     if (argc >= 2) {                                  //检查用户是否输入了文件名（argc>=2是因为程序名称本身也算一个参数）
         editorOpen(argv[1]);
     } 
 
-    editorSetStatusMessage("HELP: Ctrl-Q = quit");
+    editorSetStatusMessage("HELP: ^Q quit ^G go to ^W wrap ^X hex ^T table ^S sort ^F filter ^R reset");
+    if (argc >= 3) editorDiffOpen(argv[2]);           //给了两个文件时并排比较
+    if (attach == -1) editorSetStatusMessage("No level3 server running, opened locally");
+    if (attach == -2) editorSetStatusMessage("level3 socket belongs to another user, opened locally");
 
     while (1) {                             
         editorRefreshScreen();
@@ -163,16 +554,50 @@ void disableRawMode() {                                                       //
 int editorReadKey() {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+    while (1) {
+        if (E.job) {                                  //排序/过滤在后台进行时定时刷新进度，结束后换上结果
+            if (editorJobPoll() || editorWaitInput(JOB_REFRESH) == 0) {
+                if (winchanged) editorResize();
+                editorRefreshScreen();
+                continue;
+            }
+        }
+        if (E.buf->indexed < E.buf->mapsize && !E.hex && !editorInputPending()) {   //还没索引完时，趁没有按键继续扫描
+            editorIndexStep(E.buf->indexed + INDEX_CHUNK);
+            editorRefreshScreen();
+            continue;
+        }
+        if (E.diff && E.diff->other->indexed < E.diff->other->mapsize && !editorInputPending()) {
+            struct editorBuffer *save = E.buf;        //右边的文件也在空闲时索引
+            E.buf = E.diff->other;
+            editorIndexStep(E.buf->indexed + INDEX_CHUNK);
+            E.buf = save;
+            editorRefreshScreen();
+            continue;
+        }
+        if (E.diff && !E.diff->shown) {               //比较结果还没完整显示时定时刷新，显示新算出的差异
+            if (editorWaitInput(DIFF_REFRESH) <= 0) {
+                if (winchanged) editorResize();
+                editorRefreshScreen();
+                continue;
+            }
+        }
+        if ((nread = editorReadInput(&c)) == 1) break;
+        if (nread == -1 && errno == EINTR) {
+            if (winchanged) editorResize();
+            editorRefreshScreen();
+            continue;
+        }
         if (nread == -1 && errno != EAGAIN) die("read");
     }
     if (c == '\x1b') {                                                        
         char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (editorWaitInput(ESC_WAIT) <= 0) return '\x1b';   //后面没有字符跟着，是单独按下的Esc
+        if (editorReadInput(&seq[0]) != 1) return '\x1b';
+        if (editorReadInput(&seq[1]) != 1) return '\x1b';
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                if (editorReadInput(&seq[2]) != 1) return '\x1b';
                 if (seq[2] == '~') {
                 switch (seq[1]) {
                     case '1': return HOME_KEY;
@@ -209,6 +634,66 @@ int editorReadKey() {
     }
 }
 
+int editorReadInput(char *c) {
+    if (!E.client) return read(E.infd, c, 1);
+    while (E.inqpos == E.inqlen) {
+        int type, len;
+        char msg[MSG_MAX + 1];
+        if (E.locked) pthread_mutex_unlock(&E.buf->lock);   //等待客户端时让其他客户端使用缓冲区
+        int r = editorRecvMessage(E.infd, &type, msg, &len);
+        if (E.locked) pthread_mutex_lock(&E.buf->lock);
+        if (r == -1) editorDetach();
+        if (type == 'K') {
+            memcpy(E.inq, msg, len);
+            E.inqlen = len;
+            E.inqpos = 0;
+        } else if (type == 'W') {                 //客户端窗口大小变化，当作被信号打断处理
+            int rows, cols;
+            msg[len] = '\0';
+            if (sscanf(msg, "%d %d", &rows, &cols) == 2) editorSetSize(rows, cols);
+            errno = EINTR;
+            return -1;
+        }
+    }
+    *c = E.inq[E.inqpos++];
+    return 1;
+}
+
+int editorInputPending() {
+    if (E.inqpos < E.inqlen) return 1;
+    struct pollfd pfd = {E.infd, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+int editorWaitInput(int ms) {
+    if (E.inqpos < E.inqlen) return 1;
+    struct pollfd pfd = {E.infd, POLLIN, 0};
+    if (E.locked) pthread_mutex_unlock(&E.buf->lock);   //等待时让其他客户端使用缓冲区
+    int r = poll(&pfd, 1, ms);
+    if (E.locked) pthread_mutex_lock(&E.buf->lock);
+    return r;
+}
+
+void editorWrite(const char *s, int len) {
+    if (E.locked) pthread_mutex_unlock(&E.buf->lock);   //画面已经生成好，客户端读得慢时不能挡住其他客户端
+    while (len > 0) {
+        ssize_t n = write(E.outfd, s, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        s += n;
+        len -= n;
+    }
+    if (E.locked) pthread_mutex_lock(&E.buf->lock);
+    if (len > 0 && E.client) editorDetach();      //客户端已经断开
+}
+
+void editorQuit() {
+    editorWrite("\x1b[2J", 4);                    //退出时清屏
+    editorWrite("\x1b[H", 3);
+    if (E.client) editorDetach();                 //服务器中只断开这个客户端，缓冲区继续保留
+    exit(0);
+}
+
 void abAppend(struct abuf *ab, const char *s, int len) {
   char *new = realloc(ab->b, ab->len + len);
 
@@ -223,6 +708,12 @@ void abFree(struct abuf *ab) {
 }
 
 void die(const char *s){
+    if (E.client) {                         //服务器中出错只断开当前客户端
+        char msg[160];
+        int len = snprintf(msg, sizeof(msg), "\x1b[2J\x1b[H%s: %s\r\n", s, strerror(errno));
+        if (write(E.outfd, msg, len) == -1) {}
+        editorDetach();
+    }
     write(STDOUT_FILENO, "\x1b[2J", 4);    //检测到错误后清屏
     write(STDOUT_FILENO, "\x1b[H", 3);
     perror(s);
@@ -230,44 +721,535 @@ void die(const char *s){
 }
 
 void editorOpen(char *filename) {
-  free(E.filename);
-  E.filename = strdup(filename);
-
-  FILE *fp = fopen(filename, "r");                 //读取文件
-  if (!fp) die("fopen");
-
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                           line[linelen - 1] == '\r')) 
-      linelen--;                                  //忽略换行符的长度
-    editorAppendRow(line,linelen);
-  }
-  free(line);                                     //释放内存
-  fclose(fp);                                     //关闭文件
+  free(E.buf->filename);
+  E.buf->filename = strdup(filename);
+
+  int fd = open(filename, O_RDONLY);               //读取文件
+  if (fd == -1) die("open");
+  struct stat st;
+  if (fstat(fd, &st) == -1) die("fstat");
+
+  if (!S_ISREG(st.st_mode)) {                      //管道等无法映射的文件仍逐行读入
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) die("fdopen");
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+      while (linelen > 0 && (line[linelen - 1] == '\n' ||
+                             line[linelen - 1] == '\r')) 
+        linelen--;                                //忽略换行符的长度
+      editorAppendRow(line,linelen);
+    }
+    free(line);                                   //释放内存
+    fclose(fp);                                   //关闭文件
+  } else {
+    if (st.st_size > 0) {                         //普通文件只映射并建立行索引，行内容用到时再载入
+      E.buf->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (E.buf->map == MAP_FAILED) die("mmap");
+      E.buf->mapsize = st.st_size;
+      E.buf->filestat = st;
+
+      size_t probe = E.buf->mapsize < BINARY_PROBE ? E.buf->mapsize : BINARY_PROBE;
+      while (E.buf->mapsize >> (E.buf->hexdigits * 4) && E.buf->hexdigits < 16) E.buf->hexdigits++;
+      if (memchr(E.buf->map, '\0', probe)) {            //二进制文件直接进入十六进制视图，不建立行索引
+        E.buf->binary = 1;
+        E.hex = 1;
+      } else if ((E.buf->delim = editorDetectDelim(filename)) != 0) {
+        E.table = 1;                              //CSV/TSV默认按列显示
+        E.delim = E.buf->delim;
+      }
+      if (!E.buf->binary && editorIndexLoad(filename, &st) != 0) {
+        editorIndexStep(INDEX_CHUNK);             //没有可用的缓存时先索引一段，剩下的在空闲时完成
+      }
+    }
+    close(fd);
+  }
   
-  // 添加以下两行代码
   E.coloff = 0;  // 重置列偏移
   E.rowoff = 0;  // 重置行偏移
 }
 
+struct editorBuffer *editorNewBuffer() {
+  struct editorBuffer *b = calloc(1, sizeof(struct editorBuffer));
+  if (b == NULL) die("calloc");
+  b->blkno = -1;
+  b->hexdigits = 8;
+  pthread_mutex_init(&b->lock, NULL);
+  return b;
+}
+
+void editorFreeBuffer(struct editorBuffer *b) {
+  int j, n = b->map ? (b->row ? ROW_CACHE : 0) : b->numrows;
+  for (j = 0; j < n; j++) {
+    free(b->row[j].chars);
+    free(b->row[j].render);
+  }
+  if (b->map) munmap(b->map, b->mapsize);
+  free(b->row);
+  free(b->rowno);
+  free(b->ckpt);
+  free(b->filename);
+  pthread_mutex_destroy(&b->lock);
+  free(b);
+}
+
+erow *editorRowAt(int at) {
+  return editorFileRow(editorViewRow(at));
+}
+
+int editorNumRows() {
+  return E.view ? E.nview : E.buf->numrows;
+}
+
+int editorViewRow(int at) {
+  return E.view ? E.view[at] : at;
+}
+
+erow *editorFileRow(int filerow) {
+  if (E.buf->map == NULL) return &E.buf->row[filerow];
+  if (E.buf->row == NULL) {                          //第一次用到时分配行缓存
+    E.buf->row = calloc(ROW_CACHE, sizeof(erow));
+    E.buf->rowno = malloc(ROW_CACHE * sizeof(int));
+    if (E.buf->row == NULL || E.buf->rowno == NULL) die("malloc");
+    int j;
+    for (j = 0; j < ROW_CACHE; j++) E.buf->rowno[j] = -1;
+  }
+  int slot = filerow % ROW_CACHE;
+  erow *row = &E.buf->row[slot];
+  if (E.buf->rowno[slot] != filerow) {               //槽位被别的行占用时换出，内存只随ROW_CACHE增长
+    free(row->chars);
+    free(row->render);
+    row->render = NULL;
+    E.buf->rowno[slot] = filerow;
+    uint64_t start, end;
+    editorRowBounds(filerow, &start, &end);
+    while (end > start && (E.buf->map[end - 1] == '\n' || E.buf->map[end - 1] == '\r'))
+      end--;                                      //与getline读入时一样去掉行尾换行符
+    row->size = end - start;
+    row->chars = malloc(row->size + 1);
+    memcpy(row->chars, &E.buf->map[start], row->size);
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    if (!E.view && filerow < E.wraprows) editorWrapUpdate(filerow);
+  }
+  return row;
+}
+
+uint64_t editorHash(const char *s, size_t len, uint64_t h) {
+  size_t j;
+  for (j = 0; j < len; j++) {
+    h ^= (unsigned char)s[j];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void editorIndexStep(uint64_t upto) {
+  if (E.buf->indexed >= E.buf->mapsize) return;
+  while (E.buf->indexed < E.buf->mapsize && E.buf->indexed < upto) {
+    if (E.buf->numrows == INT_MAX) {                   //行数超出int范围，后面的内容不再显示
+      E.buf->indexed = E.buf->mapsize;
+      break;
+    }
+    if (E.buf->numrows % INDEX_STEP == 0) {
+      if (E.buf->nckpt == E.buf->ckptcap) {
+        int cap = E.buf->ckptcap ? E.buf->ckptcap * 2 : 64;
+        uint64_t *new = realloc(E.buf->ckpt, cap * sizeof(uint64_t));
+        if (new == NULL) die("realloc");
+        E.buf->ckpt = new;
+        E.buf->ckptcap = cap;
+      }
+      E.buf->ckpt[E.buf->nckpt++] = E.buf->indexed;
+    }
+    E.buf->numrows++;
+    char *nl = memchr(&E.buf->map[E.buf->indexed], '\n', E.buf->mapsize - E.buf->indexed);
+    E.buf->indexed = nl ? (uint64_t)(nl - E.buf->map) + 1 : E.buf->mapsize;
+  }
+  if (E.buf->indexed >= E.buf->mapsize && E.buf->filename)       //索引完成后写入缓存，下次打开直接使用
+    editorIndexSave(E.buf->filename, &E.buf->filestat);
+}
+
+void editorIndexUntilRow(int at) {
+  while (E.buf->numrows <= at && E.buf->indexed < E.buf->mapsize)
+    editorIndexStep(E.buf->indexed + (1 << 20));
+}
+
+void editorRowBounds(int at, uint64_t *start, uint64_t *end) {
+  int blk = at / INDEX_STEP;
+  int n = E.buf->numrows - blk * INDEX_STEP;
+  if (n > INDEX_STEP) n = INDEX_STEP;
+  if (blk != E.buf->blkno || E.buf->blkrows < n) {     //上次计算后这一段又索引了新行时也要重算
+    uint64_t pos = E.buf->ckpt[blk];                   //从检查点出发，最多扫描INDEX_STEP行
+    int j;
+    for (j = 0; j < n; j++) {
+      E.buf->blk[j] = pos;
+      char *nl = memchr(&E.buf->map[pos], '\n', E.buf->mapsize - pos);
+      pos = nl ? (uint64_t)(nl - E.buf->map) + 1 : E.buf->mapsize;
+    }
+    E.buf->blk[n] = pos;
+    E.buf->blkno = blk;
+    E.buf->blkrows = n;
+  }
+  *start = E.buf->blk[at - blk * INDEX_STEP];
+  *end = E.buf->blk[at - blk * INDEX_STEP + 1];
+}
+
+int editorRowFromOffset(uint64_t off) {
+  if (E.buf->mapsize == 0) return 0;
+  if (off >= E.buf->mapsize) off = E.buf->mapsize - 1;
+  if (off >= E.buf->indexed) {                         //离已索引的位置不远时就地补上，否则不在这里线性扫描
+    if (off - E.buf->indexed >= INDEX_CHUNK) return -1;
+    editorIndexStep(off + 1);
+  }
+  if (E.buf->numrows == 0) return 0;                   //先索引再判断：十六进制视图打开的文件可能还一行都没索引
+
+  int lo = 0, hi = E.buf->nckpt - 1;                   //先二分查找检查点，再在区间内二分
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (E.buf->ckpt[mid] <= off) lo = mid;
+    else hi = mid - 1;
+  }
+  uint64_t start, end;
+  editorRowBounds(lo * INDEX_STEP, &start, &end);
+  int first = 0, last = E.buf->blkrows - 1;
+  while (first < last) {
+    int mid = first + (last - first + 1) / 2;
+    if (E.buf->blk[mid] <= off) first = mid;
+    else last = mid - 1;
+  }
+  return lo * INDEX_STEP + first;
+}
+
+void editorAnchorAt(uint64_t off) {
+  if (off >= E.buf->mapsize) off = E.buf->mapsize - 1;
+  uint64_t start = off;
+  while (start > 0 && E.buf->map[start - 1] != '\n') start--;   //只向前找到本行行首
+  E.anchored = 1;
+  E.anchor = start;
+  E.cy = 0;
+  E.cx = off - start > INT_MAX ? INT_MAX : (int)(off - start);
+  E.rowoff = 0;
+  E.coloff = 0;
+  E.wrapoff = 0;
+  while (E.cy < E.screenrows / 2 && E.anchor > 0) {   //与按行号跳转一样让目标行位于屏幕中间
+    E.anchor = editorAnchorPrev(E.anchor);
+    E.cy++;
+  }
+  editorSetStatusMessage("Line number not known yet, indexing %d%%",
+    (int)(E.buf->indexed * 100 / E.buf->mapsize));
+}
+
+uint64_t editorAnchorNext(uint64_t pos) {
+  char *nl = memchr(&E.buf->map[pos], '\n', E.buf->mapsize - pos);
+  return nl ? (uint64_t)(nl - E.buf->map) + 1 : E.buf->mapsize;
+}
+
+uint64_t editorAnchorPrev(uint64_t pos) {
+  if (pos == 0) return 0;
+  char *nl = pos > 1 ? memrchr(E.buf->map, '\n', pos - 1) : NULL;
+  return nl ? (uint64_t)(nl - E.buf->map) + 1 : 0;
+}
+
+uint64_t editorAnchorLine(int y) {
+  uint64_t pos = E.anchor;
+  while (y-- > 0 && pos < E.buf->mapsize) pos = editorAnchorNext(pos);
+  return pos;
+}
+
+void editorAnchorRow(uint64_t pos, erow *row) {
+  uint64_t end = editorAnchorNext(pos);
+  while (end > pos && (E.buf->map[end - 1] == '\n' || E.buf->map[end - 1] == '\r'))
+    end--;
+  row->size = end - pos;
+  row->chars = malloc(row->size + 1);
+  if (row->chars == NULL) die("malloc");
+  memcpy(row->chars, &E.buf->map[pos], row->size);
+  row->chars[row->size] = '\0';
+  row->render = NULL;
+  editorUpdateRow(row);
+}
+
+void editorAnchorScroll() {
+  if (E.anchor < E.buf->indexed) {                     //索引已经追上，换算成真正的行号
+    int top = editorRowFromOffset(E.anchor);
+    E.anchored = 0;
+    E.rowoff = top;
+    E.cy += top;
+    editorScroll();
+    return;
+  }
+  uint64_t pos = E.anchor;
+  int y;
+  for (y = 0; y < E.cy; y++) {                         //光标不能越过文件末尾
+    uint64_t next = editorAnchorNext(pos);
+    if (next >= E.buf->mapsize) {
+      E.cy = y;
+      break;
+    }
+    pos = next;
+  }
+  erow row;
+  editorAnchorRow(pos, &row);
+  if (E.cx > row.size) E.cx = row.size;
+  E.rx = editorRowCxToRx(&row, E.cx);
+  free(row.chars);
+  free(row.render);
+  if (E.rx < E.coloff) E.coloff = E.rx;
+  if (E.rx >= E.coloff + E.screencols) E.coloff = E.rx - E.screencols + 1;
+}
+
+void editorDrawAnchorRows(struct abuf *ab) {
+  uint64_t pos = E.anchor;
+  int y;
+  for (y = 0; y < E.screenrows; y++) {
+    if (pos >= E.buf->mapsize) {
+      abAppend(ab, "~", 1);
+    } else {
+      erow row;
+      editorAnchorRow(pos, &row);
+      int len = row.rsize - E.coloff;
+      if (len < 0) len = 0;
+      if (len > E.screencols) len = E.screencols;
+      abAppend(ab, &row.render[E.coloff], len);
+      free(row.chars);
+      free(row.render);
+      pos = editorAnchorNext(pos);
+    }
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
+int editorAnchorMoveCursor(int key) {
+  int j;
+  switch (key) {
+    case ARROW_UP:
+      if (E.cy > 0) E.cy--;
+      else E.anchor = editorAnchorPrev(E.anchor);
+      return 1;
+    case ARROW_DOWN:
+      if (editorAnchorNext(editorAnchorLine(E.cy)) >= E.buf->mapsize) return 1;
+      if (E.cy < E.screenrows - 1) E.cy++;
+      else E.anchor = editorAnchorNext(E.anchor);
+      return 1;
+    case PAGE_UP:
+      for (j = 0; j < E.screenrows; j++) E.anchor = editorAnchorPrev(E.anchor);
+      return 1;
+    case PAGE_DOWN:
+      for (j = 0; j < E.screenrows; j++) {
+        uint64_t next = editorAnchorNext(E.anchor);
+        if (next >= E.buf->mapsize) break;
+        E.anchor = next;
+      }
+      return 1;
+    case ARROW_LEFT:
+      if (E.cx > 0) E.cx--;
+      return 1;
+    case ARROW_RIGHT:
+      if (E.cx < INT_MAX) E.cx++;                      //超过行尾的部分在editorAnchorScroll中截掉
+      return 1;
+    case HOME_KEY:
+      E.cx = 0;
+      return 1;
+    case END_KEY:
+      E.cx = INT_MAX;
+      return 1;
+    case CTRL_KEY('w'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('s'):
+    case CTRL_KEY('f'):
+    case CTRL_KEY('r'):                                //这些功能都要用到行号
+      editorSetStatusMessage("Not available until indexing reaches this position (%d%%)",
+        (int)(E.buf->indexed * 100 / E.buf->mapsize));
+      return 1;
+  }
+  return 0;
+}
+
+char *editorIndexCachePath(const char *filename) {
+  char dir[PATH_MAX], real[PATH_MAX];
+  if (realpath(filename, real) == NULL) return NULL;
+
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0]) {
+    snprintf(dir, sizeof(dir), "%s", xdg);
+  } else if (home && home[0]) {
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+  } else {
+    return NULL;
+  }
+  mkdir(dir, 0700);
+  size_t len = strlen(dir);
+  snprintf(dir + len, sizeof(dir) - len, "/level3");
+  mkdir(dir, 0700);
+
+  char *path = malloc(PATH_MAX);
+  if (path == NULL) return NULL;
+  snprintf(path, PATH_MAX, "%.*s/%016llx.idx", PATH_MAX - 22, dir,
+    (unsigned long long)editorHash(real, strlen(real), HASH_INIT));
+  return path;
+}
+
+int editorIndexLoad(const char *filename, struct stat *st) {
+  if ((size_t)st->st_size < INDEX_CACHE_MIN) return -1;
+  char *path = editorIndexCachePath(filename);
+  if (path == NULL) return -1;
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1) return -1;
+
+  struct stat cst;
+  struct lineIndexHeader *h = NULL;
+  if (fstat(fd, &cst) == 0 && (size_t)cst.st_size >= sizeof(*h)) {
+    h = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (h == MAP_FAILED) h = NULL;
+  }
+  close(fd);
+  if (h == NULL) return -1;
+
+  char real[PATH_MAX];
+  int ok = memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+           realpath(filename, real) != NULL &&
+           h->pathhash == editorHash(real, strlen(real), HASH_INIT) &&
+           h->dev == (uint64_t)st->st_dev && h->ino == (uint64_t)st->st_ino &&
+           h->numrows > 0 && h->numrows <= INT_MAX && h->size <= (uint64_t)st->st_size &&
+           h->nckpt == (h->numrows + INDEX_STEP - 1) / INDEX_STEP &&
+           (size_t)cst.st_size == sizeof(*h) + h->nckpt * sizeof(uint64_t);
+  if (ok) {                                       //检查点从0开始、严格递增且都在文件内，否则扫描行时长度会下溢
+    uint64_t *ckpt = (uint64_t *)(h + 1);
+    uint64_t j;
+    ok = ckpt[0] == 0;
+    for (j = 0; ok && j < h->nckpt; j++)
+      ok = ckpt[j] < h->size && (j == 0 || ckpt[j] > ckpt[j - 1]);
+  }
+  int hit = ok && h->size == (uint64_t)st->st_size &&
+            h->mtime == (int64_t)st->st_mtim.tv_sec &&
+            h->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+  if (ok && !hit && h->size >= (uint64_t)st->st_size)
+    ok = 0;                                       //大小没变但修改时间变了：内容可能被就地改写，缓存作废
+  if (ok && !hit) {                               //文件变大且原末尾一段内容不变，才认为只是被追加
+    uint64_t tail = h->size < INDEX_TAIL ? h->size : INDEX_TAIL;
+    ok = h->tailhash == editorHash(&E.buf->map[h->size - tail], tail, HASH_INIT);
+  }
+  if (!ok) {
+    munmap(h, cst.st_size);
+    return -1;
+  }
+
+  E.buf->ckptcap = h->nckpt + 64;
+  E.buf->ckpt = malloc(E.buf->ckptcap * sizeof(uint64_t));
+  if (E.buf->ckpt == NULL) die("malloc");
+  memcpy(E.buf->ckpt, h + 1, h->nckpt * sizeof(uint64_t));
+  E.buf->nckpt = h->nckpt;
+  E.buf->numrows = h->numrows;
+
+  munmap(h, cst.st_size);
+  if (hit) {
+    E.buf->indexed = E.buf->mapsize;
+    return 0;
+  }
+
+  E.buf->nckpt--;                                      //文件被追加，从最后一个检查点开始重新扫描
+  E.buf->numrows = E.buf->nckpt * INDEX_STEP;
+  E.buf->indexed = E.buf->ckpt[E.buf->nckpt];
+  return 1;
+}
+
+void editorIndexAdopt(uint64_t *spans, int n) {
+  int k, nckpt = (int)(((int64_t)n + INDEX_STEP - 1) / INDEX_STEP);
+  if (nckpt > E.buf->ckptcap) {
+    uint64_t *new = realloc(E.buf->ckpt, nckpt * sizeof(uint64_t));
+    if (new == NULL) die("realloc");
+    E.buf->ckpt = new;
+    E.buf->ckptcap = nckpt;
+  }
+  for (k = 0; k < nckpt; k++) E.buf->ckpt[k] = spans[(size_t)k * INDEX_STEP];
+  E.buf->nckpt = nckpt;
+  E.buf->numrows = n;
+  E.buf->indexed = E.buf->mapsize;
+  E.buf->blkno = -1;
+  if (E.buf->filename) editorIndexSave(E.buf->filename, &E.buf->filestat);
+}
+
+void editorIndexSave(const char *filename, struct stat *st) {
+  if ((size_t)st->st_size < INDEX_CACHE_MIN) return;
+  char *path = editorIndexCachePath(filename);
+  if (path == NULL) return;
+  char real[PATH_MAX];
+  if (realpath(filename, real) == NULL) {
+    free(path);
+    return;
+  }
+
+  struct lineIndexHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+  h.pathhash = editorHash(real, strlen(real), HASH_INIT);
+  h.size = E.buf->mapsize;
+  h.mtime = st->st_mtim.tv_sec;
+  h.mtime_nsec = st->st_mtim.tv_nsec;
+  h.dev = st->st_dev;
+  h.ino = st->st_ino;
+  uint64_t tail = E.buf->mapsize < INDEX_TAIL ? E.buf->mapsize : INDEX_TAIL;
+  h.tailhash = editorHash(&E.buf->map[E.buf->mapsize - tail], tail, HASH_INIT);
+  h.numrows = E.buf->numrows;
+  h.nckpt = E.buf->nckpt;
+
+  char tmp[PATH_MAX + 32];                        //先写临时文件再改名，避免留下写了一半的缓存
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd != -1) {
+    size_t len = E.buf->nckpt * sizeof(uint64_t);
+    int ok = write(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) &&
+             write(fd, E.buf->ckpt, len) == (ssize_t)len;
+    close(fd);
+    if (!ok || rename(tmp, path) == -1) unlink(tmp);
+  }
+  free(path);
+}
+
 void editorRefreshScreen() {
     editorScroll();
+    struct abuf frame = ABUF_INIT;
+    if (E.diff) editorDrawDiffRows(&frame);
+    else if (E.hex) editorDrawHexRows(&frame);
+    else if (E.anchored) editorDrawAnchorRows(&frame);
+    else if (E.table) editorDrawTableRows(&frame);
+    else editorDrawRows(&frame);
+    editorDrawStatusBar(&frame);
+    editorDrawMessageBar(&frame);
+
     struct abuf ab = ABUF_INIT;
     abAppend(&ab, "\x1b[?25l", 6);      
-    abAppend(&ab, "\x1b[H", 3);         //转义序列esc[H表示定位光标至左上角
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-      editorDrawMessageBar(&ab);
+    if (E.client) {                     //客户端只接收变化了的行
+      editorFrameDiff(&ab, &frame);
+    } else {
+      abAppend(&ab, "\x1b[H", 3);       //转义序列esc[H表示定位光标至左上角
+      abAppend(&ab, frame.b, frame.len);
+    }
+    abFree(&frame);
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-                                              (E.rx - E.coloff) + 1);
+    if (E.diff)
+      snprintf(buf, sizeof(buf), "\x1b[%d;1H", (E.cy - E.rowoff) + 1);
+    else if (E.hex)
+      snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (int)(E.hexcur / HEX_WIDTH - E.hexoff) + 1,
+                                                editorHexCursorCol() + 1);
+    else if (E.anchored)
+      snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.cy + 1, (E.rx - E.coloff) + 1);
+    else if (E.table)
+      snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, E.tablecx + 1);
+    else if (E.wrap)
+      snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.wrapcy + 1, E.wrapcx + 1);
+    else
+      snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
+                                                (E.rx - E.coloff) + 1);
     abAppend(&ab, buf, strlen(buf));
     abAppend(&ab, "\x1b[?25h", 6);
-    write(STDOUT_FILENO, ab.b,ab.len);  //写入缓冲区内容
+    editorWrite(ab.b, ab.len);          //写入缓冲区内容
     abFree(&ab);
 }
 
@@ -284,13 +1266,42 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
+void handleSigWinCh(int unused) {
+    (void)unused;
+    winchanged = 1;
+}
+
+void editorResize() {
+    winchanged = 0;
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+    editorSetSize(rows, cols);
+}
+
+void editorSetSize(int rows, int cols) {
+    int oldcols = E.screencols;
+    E.screenrows = rows - 2;                       //留出状态栏和消息栏
+    E.screencols = cols;
+    if (E.screenrows < 1) E.screenrows = 1;
+    if (E.screencols < 1) E.screencols = 1;
+    if (oldcols != E.screencols) E.wrapgeneration++;  //宽度变了，换行结果全部作废，只在显示到时重算
+
+    int j;                                         //客户端的上一帧作废，下次整屏重画
+    for (j = 0; j < E.framerows; j++) abFree(&E.frame[j]);
+    free(E.frame);
+    E.frame = NULL;
+    E.framerows = 0;
+}
+
 
 void editorDrawRows(struct abuf *ab) {
   int y;
+  int filerow = E.rowoff;
+  int seg = E.wrapoff;
   for (y = 0; y < E.screenrows; y++) {
-    int filerow = y + E.rowoff;
-    if (filerow >= E.numrows) {
-      if (E.numrows == 0 && y == E.screenrows / 3) {
+    if (!E.wrap) filerow = y + E.rowoff;
+    if (filerow >= editorNumRows()) {
+      if (editorNumRows() == 0 && y == E.screenrows / 3) {
         char welcome[80];
         int welcomelen = snprintf(welcome, sizeof(welcome),
           "wlecome editor -- version %s", VERSION);
@@ -305,11 +1316,23 @@ void editorDrawRows(struct abuf *ab) {
       } else {
         abAppend(ab, "~", 1);
       }
+    } else if (E.wrap) {                          //软换行：每段显示一屏宽，画完一行的所有段再换下一行
+      erow *row = editorRowAt(filerow);
+      int start = seg * E.screencols;
+      int len = row->rsize - start;
+      if (len < 0) len = 0;
+      if (len > E.screencols) len = E.screencols;
+      abAppend(ab, &row->render[start], len);
+      if (++seg >= editorWrapRow(filerow)) {
+        filerow++;
+        seg = 0;
+      }
     } else {
-      int len = E.row[filerow].rsize - E.coloff;
+      erow *row = editorRowAt(filerow);
+      int len = row->rsize - E.coloff;
       if (len < 0) len = 0;
       if (len > E.screencols) len = E.screencols;
-      abAppend(ab, &E.row[filerow].render[E.coloff], len);
+      abAppend(ab, &row->render[E.coloff], len);
     }
     abAppend(ab, "\x1b[K", 3);
     abAppend(ab, "\r\n", 2);
@@ -317,7 +1340,7 @@ void editorDrawRows(struct abuf *ab) {
 }
 
 void editorMoveCursor(int key) {
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *row = (E.cy >= editorNumRows()) ? NULL : editorRowAt(E.cy);
   switch (key) {
     case ARROW_LEFT:
       if (E.cx != 0) {
@@ -325,7 +1348,7 @@ void editorMoveCursor(int key) {
       } 
       else if (E.cy > 0) {
         E.cy--;
-        E.cx = E.row[E.cy].size;               //允许在行首时左移换至上一行
+        E.cx = editorRowAt(E.cy)->size;        //允许在行首时左移换至上一行
       }
       break;
     case ARROW_RIGHT:
@@ -343,12 +1366,12 @@ void editorMoveCursor(int key) {
       }
       break;
     case ARROW_DOWN:
-      if (E.cy < E.numrows) {
+      if (E.cy < editorNumRows()) {
         E.cy++;
       }
       break;
   }
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.cy >= editorNumRows()) ? NULL : editorRowAt(E.cy);
     int rowlen = row ? row->size : 0;
     if (E.cx > rowlen) {
     E.cx = rowlen;
@@ -357,33 +1380,66 @@ void editorMoveCursor(int key) {
 
 void editorProcessKeypress() {
     int c = editorReadKey();
+    if (E.job && c == '\x1b') {                   //Esc取消后台的排序/过滤
+      editorJobCancel();
+      return;
+    }
+    if (E.diff && editorDiffMoveCursor(c)) return;
+    if (E.hex && editorHexMoveCursor(c)) return;
+    if (!E.hex && E.anchored && editorAnchorMoveCursor(c)) return;
+    if (!E.hex && E.table && editorTableMoveCursor(c)) return;
     switch (c) {
         case CTRL_KEY('q'):                 //将ctrl+q重构为退出键
-            write(STDOUT_FILENO, "\x1b[2J", 4); //退出时清屏
-            write(STDOUT_FILENO, "\x1b[H", 3);  
-            exit(0);
+            editorQuit();
             break;
         case HOME_KEY:
             E.cx = 0;
             break;
         case END_KEY:
-            if (E.cy < E.numrows)
-            E.cx = E.row[E.cy].size;
+            if (E.cy < editorNumRows())
+            E.cx = editorRowAt(E.cy)->size;
+            break;
+        case CTRL_KEY('g'):
+            editorGoto();
+            break;
+        case CTRL_KEY('w'):
+            editorToggleWrap();
+            break;
+        case CTRL_KEY('x'):
+            editorToggleHex();
+            break;
+        case CTRL_KEY('t'):
+            editorToggleTable();
+            break;
+        case CTRL_KEY('s'):
+            editorSortRows();
+            break;
+        case CTRL_KEY('f'):
+            editorFilterRows();
+            break;
+        case CTRL_KEY('r'):
+            editorResetView();
             break;
         case PAGE_UP:
         case PAGE_DOWN:
-            {
-                if (c == PAGE_UP) {
-                  E.cy = E.rowoff;
-                } 
-                else if (c == PAGE_DOWN) {
-                  E.cy = E.rowoff + E.screenrows - 1;
-                  if (E.cy > E.numrows) E.cy = E.numrows;
+            {                                   //直接把光标和视图平移一屏，不再逐行移动
+                int delta = (c == PAGE_UP) ? -E.screenrows : E.screenrows;
+                if (E.wrap) {
+                  editorWrapPage(delta);
+                  break;
                 }
+                if (c == PAGE_DOWN) editorIndexUntilRow(E.cy + delta);
+                E.cy += delta;
+                E.rowoff += delta;
+                if (E.cy > editorNumRows()) E.cy = editorNumRows();
+                if (E.cy < 0) E.cy = 0;
+                if (E.rowoff > editorNumRows() - E.screenrows + 1) E.rowoff = editorNumRows() - E.screenrows + 1;
+                if (E.rowoff > E.cy) E.rowoff = E.cy;
+                if (E.rowoff < 0) E.rowoff = 0;
 
-                int times = E.screenrows;
-                while (times--)
-                editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+                erow *row = (E.cy >= editorNumRows()) ? NULL : editorRowAt(E.cy);
+                int rowlen = row ? row->size : 0;
+                if (E.cx > rowlen) E.cx = rowlen;
             }
             break;
         case ARROW_UP:
@@ -396,27 +1452,44 @@ void editorProcessKeypress() {
 }
 
 void editorAppendRow(char *s, size_t len) {
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+  E.buf->row = realloc(E.buf->row, sizeof(erow) * (E.buf->numrows + 1));
   
-  int at = E.numrows;                      //行数
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);       //分配空间
-  memcpy(E.row[at].chars, s, len);         //拷贝内容到E.row.chars
-  E.row[at].chars[len] = '\0';
+  int at = E.buf->numrows;                      //行数
+  E.buf->row[at].size = len;
+  E.buf->row[at].chars = malloc(len + 1);       //分配空间
+  memcpy(E.buf->row[at].chars, s, len);         //拷贝内容到E.buf->row.chars
+  E.buf->row[at].chars[len] = '\0';
   
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
+  E.buf->row[at].rsize = 0;
+  E.buf->row[at].render = NULL;
   
   // 初始化后立即更新渲染内容
-  editorUpdateRow(&E.row[at]);  // 添加这一行
+  editorUpdateRow(&E.buf->row[at]);  // 添加这一行
   
-  E.numrows++;
+  E.buf->numrows++;
 }
 
 void editorScroll() {
+  if (E.diff) {
+    editorDiffScroll();
+    return;
+  }
+  if (E.hex) {
+    editorHexScroll();
+    return;
+  }
+  if (E.anchored) {
+    editorAnchorScroll();
+    return;
+  }
+  editorIndexUntilRow(E.cy);
   E.rx = 0;
-  if (E.cy < E.numrows) {
-    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+  if (E.cy < editorNumRows()) {
+    E.rx = editorRowCxToRx(editorRowAt(E.cy), E.cx);
+  }
+  if (E.wrap) {
+    editorWrapScroll();
+    return;
   }
   if (E.cy < E.rowoff) {
     E.rowoff = E.cy;
@@ -424,6 +1497,11 @@ void editorScroll() {
   if (E.cy >= E.rowoff + E.screenrows) {
     E.rowoff = E.cy - E.screenrows + 1;
   }
+  editorIndexUntilRow(E.rowoff + E.screenrows);
+  if (E.table) {
+    editorTableScroll();
+    return;
+  }
   if (E.rx < E.coloff) {
     E.coloff = E.rx;
   }
@@ -465,13 +1543,72 @@ int editorRowCxToRx(erow *row, int cx) {
   return rx;
 }
 
+int editorRowRxToCx(erow *row, int rx) {
+  int cur_rx = 0;
+  int cx;
+  for (cx = 0; cx < row->size; cx++) {
+    if (row->chars[cx] == '\t')
+      cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+    cur_rx++;
+    if (cur_rx > rx) return cx;
+  }
+  return cx;
+}
+
 void editorDrawStatusBar(struct abuf *ab) {
   abAppend(ab, "\x1b[7m", 4);
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines",
-    E.filename ? E.filename : "[No Name]", E.numrows);
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-    E.cy + 1, E.numrows);
+  int len, rlen;
+  if (E.diff) {
+    struct editorDiff *d = E.diff;
+    pthread_mutex_lock(&d->lock);
+    int nhunk = d->nhunk, done = d->done;
+    int pct = d->asize + d->bsize ? (int)((d->abytes + d->bbytes) * 100 / (d->asize + d->bsize)) : 0;
+    pthread_mutex_unlock(&d->lock);
+    const char *a = E.buf->filename ? E.buf->filename : "[No Name]";
+    const char *b = d->other->filename ? d->other->filename : "[No Name]";
+    if (done && nhunk == 0)
+      len = snprintf(status, sizeof(status), "%.20s <> %.20s - identical", a, b);
+    else if (done)
+      len = snprintf(status, sizeof(status), "%.20s <> %.20s - %d hunk%s", a, b, nhunk, nhunk == 1 ? "" : "s");
+    else                                          //比较还在进行时显示进度
+      len = snprintf(status, sizeof(status), "%.20s <> %.20s - %d+ hunks (comparing %d%%)", a, b, nhunk, pct);
+    rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, editorDiffRows());
+  } else if (E.hex) {
+    len = snprintf(status, sizeof(status), "%.20s - %llu bytes (hex)",
+      E.buf->filename ? E.buf->filename : "[No Name]", (unsigned long long)E.buf->mapsize);
+    rlen = snprintf(rstatus, sizeof(rstatus), "0x%llx/0x%llx",
+      (unsigned long long)E.hexcur, (unsigned long long)E.buf->mapsize);
+  } else {
+    if (E.job) {                                  //后台排序/过滤的进度
+      pthread_mutex_lock(&E.job->lock);
+      int pct = E.job->total > 0 ? (int)(E.job->work * 100 / E.job->total) : 0;
+      len = snprintf(status, sizeof(status), "%.20s - %s: %s %d%% (Esc cancels)",
+        E.buf->filename ? E.buf->filename : "[No Name]", E.job->filter ? "filter" : "sort",
+        E.job->stage, pct > 100 ? 100 : pct);
+      pthread_mutex_unlock(&E.job->lock);
+    } else if (E.buf->indexed < E.buf->mapsize)             //索引还没完成时显示进度
+      len = snprintf(status, sizeof(status), "%.20s - %d+ lines (indexing %d%%)",
+        E.buf->filename ? E.buf->filename : "[No Name]", E.buf->numrows, (int)(E.buf->indexed * 100 / E.buf->mapsize));
+    else if (E.view)
+      len = snprintf(status, sizeof(status), "%.20s - %d of %d lines (view)",
+        E.buf->filename ? E.buf->filename : "[No Name]", E.nview, E.buf->numrows);
+    else
+      len = snprintf(status, sizeof(status), "%.20s - %d lines",
+        E.buf->filename ? E.buf->filename : "[No Name]", E.buf->numrows);
+    if (E.anchored)                               //行号未知时显示光标所在的字节偏移
+      rlen = snprintf(rstatus, sizeof(rstatus), "?/%d+ @0x%llx",
+        E.buf->numrows, (unsigned long long)(editorAnchorLine(E.cy) + E.cx));
+    else if (E.table && E.ncols)                  //表格模式同时显示光标所在列
+      rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d C%d/%d",
+        E.cy + 1, editorNumRows(), E.tcol + 1, E.ncols);
+    else if (E.view && E.cy < E.nview)            //排序/过滤后同时显示原文件中的行号
+      rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d [L%d]",
+        E.cy + 1, E.nview, E.view[E.cy] + 1);
+    else
+      rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
+        E.cy + 1, editorNumRows());
+  }
   if (len > E.screencols) len = E.screencols;
   abAppend(ab, status, len);
   while (len < E.screencols) {
@@ -502,4 +1639,1904 @@ void editorDrawMessageBar(struct abuf *ab) {
   if (msglen > E.screencols) msglen = E.screencols;
   if (msglen && time(NULL) - E.statusmsg_time < 5)
     abAppend(ab, E.statusmsg, msglen);
-}
\ No newline at end of file
+}
+
+char *editorPrompt(char *prompt) {
+  size_t bufsize = 128;
+  char *buf = malloc(bufsize);
+  size_t buflen = 0;
+  buf[0] = '\0';
+
+  while (1) {
+    editorSetStatusMessage(prompt, buf);
+    editorRefreshScreen();
+
+    int c = editorReadKey();
+    if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+      if (buflen != 0) buf[--buflen] = '\0';
+    } else if (c == '\x1b') {                     //Esc取消输入
+      editorSetStatusMessage("");
+      free(buf);
+      return NULL;
+    } else if (c == '\r') {
+      if (buflen != 0) {
+        editorSetStatusMessage("");
+        return buf;
+      }
+    } else if (!iscntrl(c) && c < 128) {
+      if (buflen == bufsize - 1) {
+        bufsize *= 2;
+        buf = realloc(buf, bufsize);
+      }
+      buf[buflen++] = c;
+      buf[buflen] = '\0';
+    }
+  }
+}
+
+void editorGoto() {
+  char *query = editorPrompt("Go to (line, N%%, @offset): %s (ESC to cancel)");
+  if (query == NULL) return;
+
+  char *end;
+  int col = 0;
+  int at;
+  if (E.hex) {                                    //十六进制视图中行号按HEX_WIDTH字节一行计算
+    unsigned long long n = strtoull(query + (query[0] == '@'), &end, 0);
+    if (end == query + (query[0] == '@') || (*end != '\0' && strcmp(end, "%") != 0)) {
+      editorSetStatusMessage("Bad location: %s", query);
+    } else {
+      if (*end == '%') n = n >= 100 ? E.buf->mapsize : (unsigned long long)(E.buf->mapsize * (n / 100.0));
+      else if (query[0] != '@') n = n ? (n - 1) * HEX_WIDTH : 0;
+      E.hexcur = n < E.buf->mapsize ? n : E.buf->mapsize - 1;
+      E.hexoff = E.hexcur / HEX_WIDTH > (uint64_t)E.screenrows / 2 ?
+                 E.hexcur / HEX_WIDTH - E.screenrows / 2 : 0;
+    }
+    free(query);
+    return;
+  }
+  if (query[0] == '@') {                          //字节偏移，支持0x前缀
+    unsigned long long off = strtoull(query + 1, &end, 0);
+    if (E.buf->map == NULL || *end != '\0' || E.view) {
+      editorSetStatusMessage(E.view ? "Offsets are not available in a sorted/filtered view"
+                                    : "Bad offset: %s", query);
+      free(query);
+      return;
+    }
+    if (off >= E.buf->mapsize) off = E.buf->mapsize ? E.buf->mapsize - 1 : 0;
+    at = editorRowFromOffset(off);
+    if (at < 0) {                                 //还没索引到：先按偏移显示
+      free(query);
+      editorAnchorAt(off);
+      return;
+    }
+    if (at < editorNumRows()) {
+      uint64_t start, rowend;
+      editorRowBounds(at, &start, &rowend);
+      col = off - start;
+    }
+  } else {
+    double n = strtod(query, &end);
+    if (end == query || (*end != '\0' && strcmp(end, "%") != 0) || n < 0) {
+      editorSetStatusMessage("Bad location: %s", query);
+      free(query);
+      return;
+    }
+    if (*end == '%') {                            //百分比按字节位置换算，不需要先索引完整个文件
+      if (n > 100) n = 100;
+      if (E.buf->map && !E.view) {
+        uint64_t off = (uint64_t)(E.buf->mapsize * (n / 100));
+        at = editorRowFromOffset(off);
+        if (at < 0) {
+          free(query);
+          editorAnchorAt(off);
+          return;
+        }
+      } else
+        at = (int)(editorNumRows() * (n / 100));
+    } else {
+      at = n >= INT_MAX ? INT_MAX - 1 : (int)n - 1;
+      if (at < 0) at = 0;
+      editorIndexUntilRow(at);
+    }
+  }
+  free(query);
+
+  if (at >= editorNumRows()) at = editorNumRows() > 0 ? editorNumRows() - 1 : 0;
+  E.anchored = 0;
+  E.cy = at;
+  E.cx = 0;
+  if (at < editorNumRows()) {
+    erow *row = editorRowAt(at);
+    E.cx = col < row->size ? col : row->size;
+  }
+  E.rowoff = E.cy - E.screenrows / 2;             //跳转后让目标行位于屏幕中间
+  if (E.rowoff < 0) E.rowoff = 0;
+}
+
+void editorToggleWrap() {
+  E.wrap = !E.wrap;
+  if (E.wrap) E.table = 0;                        //表格按列截断显示，不换行
+  E.wrapoff = 0;
+  E.coloff = 0;
+  editorSetStatusMessage("Soft wrap %s", E.wrap ? "on" : "off");
+}
+
+void editorWrapSync() {
+  if (E.wraprows == editorNumRows()) return;
+  if (editorNumRows() > E.wrapcap) {
+    int cap = E.wrapcap ? E.wrapcap : 1024;
+    while (cap < editorNumRows()) cap = cap > INT_MAX / 2 ? INT_MAX : cap * 2;
+    E.wrapcnt = realloc(E.wrapcnt, sizeof(int) * cap);
+    E.wrapgen = realloc(E.wrapgen, sizeof(int) * cap);
+    E.fen = realloc(E.fen, sizeof(int64_t) * (cap + 1));
+    if (!E.wrapcnt || !E.wrapgen || !E.fen) die("realloc");
+    E.wrapcap = cap;
+  }
+  int old = E.wraprows;
+  int64_t sum = editorFenPrefix(old);
+  int i;
+  for (i = old + 1; i <= editorNumRows(); i++) {       //新行都按1估计，管辖区间全是新行时和就是区间长度，线性建树
+    int low = i - (i & -i);
+    E.wrapcnt[i - 1] = 1;
+    E.wrapgen[i - 1] = E.wrapgeneration - 1;
+    E.fen[i] = low >= old ? i - low : sum - editorFenPrefix(low) + i - old;   //跨过旧末尾的区间最多log n个
+  }
+  E.wraprows = editorNumRows();
+}
+
+int editorWrapRow(int at) {
+  if (E.wrapgen[at] != E.wrapgeneration) editorWrapUpdate(at);
+  return E.wrapcnt[at];
+}
+
+void editorWrapUpdate(int at) {
+  erow *row = editorRowAt(at);
+  int cnt = row->rsize ? (row->rsize + E.screencols - 1) / E.screencols : 1;
+  if (cnt != E.wrapcnt[at]) editorFenAdd(at, cnt - E.wrapcnt[at]);
+  E.wrapcnt[at] = cnt;
+  E.wrapgen[at] = E.wrapgeneration;
+}
+
+void editorWrapAround(int at) {
+  int first = at - E.screenrows;
+  int last = at + E.screenrows;
+  if (first < 0) first = 0;
+  if (last > editorNumRows()) last = editorNumRows();
+  for (; first < last; first++) editorWrapRow(first);
+}
+
+void editorWrapScroll() {
+  editorWrapSync();
+  E.coloff = 0;
+  editorWrapAround(E.rowoff);
+  editorWrapAround(E.cy);
+
+  int seg = 0;
+  if (E.cy < editorNumRows()) {
+    seg = E.rx / E.screencols;
+    if (seg >= E.wrapcnt[E.cy]) seg = E.wrapcnt[E.cy] - 1;
+  }
+  int64_t cur = editorFenPrefix(E.cy) + seg;      //视图附近的行已精确计算，差值不受远处估计值影响
+  int64_t top = editorFenPrefix(E.rowoff) + E.wrapoff;
+  if (cur < top) top = cur;
+  if (cur >= top + E.screenrows) top = cur - E.screenrows + 1;
+  E.rowoff = editorFenFind(top, &E.wrapoff);
+
+  E.wrapcy = cur - top;
+  E.wrapcx = E.rx - seg * E.screencols;
+  if (E.wrapcx >= E.screencols) E.wrapcx = E.screencols - 1;
+}
+
+void editorWrapPage(int delta) {
+  editorWrapSync();
+  editorIndexUntilRow(E.cy + delta);
+  editorWrapSync();
+  if (editorNumRows() == 0) return;
+  int64_t total = editorFenPrefix(editorNumRows());
+  int64_t top = editorFenPrefix(E.rowoff) + E.wrapoff + delta;
+  int64_t cur = top + E.wrapcy;
+  if (top > total - E.screenrows) top = total - E.screenrows;
+  if (top < 0) top = 0;
+  if (cur >= total) cur = total - 1;
+  if (cur < 0) cur = 0;
+
+  int seg;                                        //先按估计值定位，精确计算附近的行后再定位一次
+  editorWrapAround(editorFenFind(cur, &seg));
+  E.cy = editorFenFind(cur, &seg);
+  E.rowoff = editorFenFind(top, &E.wrapoff);
+  E.cx = 0;
+  if (E.cy < editorNumRows())
+    E.cx = editorRowRxToCx(editorRowAt(E.cy), seg * E.screencols + E.wrapcx);
+}
+
+void editorFenAdd(int at, int64_t delta) {
+  int i;
+  for (i = at + 1; i <= E.wraprows; i += i & -i) E.fen[i] += delta;
+}
+
+int64_t editorFenPrefix(int n) {
+  int64_t sum = 0;
+  if (n > E.wraprows) n = E.wraprows;
+  for (; n > 0; n -= n & -n) sum += E.fen[n];
+  return sum;
+}
+
+int editorFenFind(int64_t line, int *seg) {
+  int pos = 0;
+  int step = 1;
+  while (step <= E.wraprows / 2) step *= 2;
+  for (; step > 0; step /= 2) {                   //树上二分，找出前缀和不超过line的最长前缀
+    if (pos + step <= E.wraprows && E.fen[pos + step] <= line) {
+      pos += step;
+      line -= E.fen[pos];
+    }
+  }
+  *seg = (int)line;
+  if (pos >= E.wraprows) *seg = 0;
+  return pos;
+}
+
+void editorToggleHex() {
+  if (E.buf->map == NULL) {
+    editorSetStatusMessage("Hex view needs a regular, non-empty file");
+    return;
+  }
+  E.hex = !E.hex;
+  if (E.hex) {                                    //保持大致相同的位置
+    if (E.anchored) {
+      E.hexcur = editorAnchorLine(E.cy) + E.cx;
+      if (E.hexcur >= E.buf->mapsize) E.hexcur = E.buf->mapsize - 1;
+      E.anchored = 0;
+    } else if (E.cy < editorNumRows()) {
+      uint64_t start, end;
+      editorRowBounds(editorViewRow(E.cy), &start, &end);
+      E.hexcur = start + E.cx;
+    }
+    E.hexoff = E.hexcur / HEX_WIDTH;
+  } else {
+    E.cy = editorRowFromOffset(E.hexcur);
+    if (E.cy < 0) {                               //离已索引的位置太远，先按偏移显示
+      editorAnchorAt(E.hexcur);
+      editorSetStatusMessage("Hex view off, line number not known yet");
+      return;
+    }
+    if (E.view) {                                 //排序/过滤后找到该行在索引向量中的位置
+      int filerow = E.cy, j;
+      E.cy = 0;
+      for (j = 0; j < E.nview; j++) {
+        if (E.view[j] == filerow) {
+          E.cy = j;
+          break;
+        }
+      }
+    }
+    E.cx = 0;
+    E.rowoff = E.cy;
+    E.wrapoff = 0;
+  }
+  editorSetStatusMessage("Hex view %s", E.hex ? "on" : "off");
+}
+
+void editorHexEncode(const unsigned char *src, char *dst) {
+#ifdef __SSE2__
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i lo = _mm_and_si128(v, mask);
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+  __m128i nine = _mm_set1_epi8(9);
+  __m128i zero = _mm_set1_epi8('0');
+  __m128i alpha = _mm_set1_epi8('a' - '0' - 10);  //大于9的半字节再加上这个差值得到'a'-'f'
+  lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+  hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+  _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+#else
+  static const char digits[] = "0123456789abcdef";
+  int j;
+  for (j = 0; j < HEX_WIDTH; j++) {
+    dst[j * 2] = digits[src[j] >> 4];
+    dst[j * 2 + 1] = digits[src[j] & 0x0f];
+  }
+#endif
+}
+
+void editorHexAscii(const unsigned char *src, char *dst) {
+#ifdef __SSE2__
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),   //按有符号比较，0x80以上为负数
+                                    _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+  __m128i out = _mm_or_si128(_mm_and_si128(printable, v),
+                             _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+  _mm_storeu_si128((__m128i *)dst, out);
+#else
+  int j;
+  for (j = 0; j < HEX_WIDTH; j++)
+    dst[j] = (src[j] >= 0x20 && src[j] < 0x7f) ? src[j] : '.';
+#endif
+}
+
+void editorDrawHexRows(struct abuf *ab) {
+  int y;
+  for (y = 0; y < E.screenrows; y++) {            //只格式化屏幕上可见的字节
+    uint64_t off = (E.hexoff + y) * HEX_WIDTH;
+    if (off >= E.buf->mapsize) {
+      abAppend(ab, "~", 1);
+    } else {
+      unsigned char bytes[HEX_WIDTH];
+      const unsigned char *src = (const unsigned char *)&E.buf->map[off];
+      int n = HEX_WIDTH;
+      if (E.buf->mapsize - off < HEX_WIDTH) {          //最后不满一行时补零，多出的部分显示为空白
+        n = E.buf->mapsize - off;
+        memset(bytes, 0, sizeof(bytes));
+        memcpy(bytes, src, n);
+        src = bytes;
+      }
+      char hex[HEX_WIDTH * 2], ascii[HEX_WIDTH];
+      char line[HEX_WIDTH * 4 + 32];
+      editorHexEncode(src, hex);
+      editorHexAscii(src, ascii);
+
+      int len = snprintf(line, sizeof(line), "%0*llx  ", E.buf->hexdigits, (unsigned long long)off);
+      int j;
+      for (j = 0; j < HEX_WIDTH; j++) {
+        if (j < n) {
+          line[len++] = hex[j * 2];
+          line[len++] = hex[j * 2 + 1];
+        } else {
+          line[len++] = ' ';
+          line[len++] = ' ';
+        }
+        line[len++] = ' ';
+        if (j == HEX_WIDTH / 2 - 1) line[len++] = ' ';
+      }
+      line[len++] = '|';
+      memcpy(&line[len], ascii, n);
+      len += n;
+      line[len++] = '|';
+
+      if (len > E.screencols) len = E.screencols;
+      abAppend(ab, line, len);
+    }
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
+void editorHexScroll() {
+  uint64_t line = E.hexcur / HEX_WIDTH;
+  if (line < E.hexoff) E.hexoff = line;
+  if (line >= E.hexoff + E.screenrows) E.hexoff = line - E.screenrows + 1;
+}
+
+int editorHexMoveCursor(int key) {
+  uint64_t page = (uint64_t)E.screenrows * HEX_WIDTH;
+  uint64_t last = E.buf->mapsize - 1;
+  switch (key) {
+    case ARROW_LEFT:
+      if (E.hexcur > 0) E.hexcur--;
+      break;
+    case ARROW_RIGHT:
+      if (E.hexcur < last) E.hexcur++;
+      break;
+    case ARROW_UP:
+      if (E.hexcur >= HEX_WIDTH) E.hexcur -= HEX_WIDTH;
+      break;
+    case ARROW_DOWN:
+      if (E.hexcur + HEX_WIDTH <= last) E.hexcur += HEX_WIDTH;
+      break;
+    case PAGE_UP:                                 //光标和视图一起平移一屏
+      E.hexcur = E.hexcur >= page ? E.hexcur - page : E.hexcur % HEX_WIDTH;
+      E.hexoff = E.hexoff >= (uint64_t)E.screenrows ? E.hexoff - E.screenrows : 0;
+      break;
+    case PAGE_DOWN:
+      if (E.hexcur + page <= last) {
+        E.hexcur += page;
+        E.hexoff += E.screenrows;
+      } else {
+        E.hexcur = last;
+      }
+      break;
+    case HOME_KEY:
+      E.hexcur -= E.hexcur % HEX_WIDTH;
+      break;
+    case END_KEY:
+      E.hexcur += HEX_WIDTH - 1 - E.hexcur % HEX_WIDTH;
+      if (E.hexcur > last) E.hexcur = last;
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+int editorHexCursorCol() {
+  int j = E.hexcur % HEX_WIDTH;
+  int col = E.buf->hexdigits + 2 + j * 3 + (j >= HEX_WIDTH / 2);
+  return col < E.screencols ? col : E.screencols - 1;
+}
+void editorToggleTable() {
+  if (E.hex) {
+    editorSetStatusMessage("Leave hex view first (Ctrl-X)");
+    return;
+  }
+  if (!E.table) {
+    char delim = E.buf->delim;
+    if (!delim && editorNumRows() > 0) {          //扩展名看不出来时，取第一行中出现最多的分隔符
+      const char *cand = "\t,;|";
+      erow *row = editorRowAt(0);
+      int best = 0, j, k;
+      for (k = 0; cand[k]; k++) {
+        int cnt = 0;
+        for (j = 0; j < row->size; j++)
+          if (row->chars[j] == cand[k]) cnt++;
+        if (cnt > best) {
+          best = cnt;
+          delim = cand[k];
+        }
+      }
+    }
+    if (!delim) {
+      editorSetStatusMessage("No delimiter found on the first line");
+      return;
+    }
+    if (delim != E.delim) {                       //换了分隔符，缓存的切分结果和列宽都作废
+      int j;
+      if (E.fields)
+        for (j = 0; j < TABLE_CACHE; j++) E.fields[j].row = -1;
+      E.ncols = 0;
+      E.sampled = 0;
+      E.delim = delim;
+    }
+  }
+  E.table = !E.table;
+  if (E.table) E.wrap = 0;
+  E.cx = 0;
+  E.coloff = 0;
+  if (E.table)
+    editorSetStatusMessage("Table view on (delimiter %s)", E.delim == '\t' ? "tab" :
+                           E.delim == ',' ? "','" : E.delim == ';' ? "';'" : "'|'");
+  else
+    editorSetStatusMessage("Table view off");
+}
+
+char editorDetectDelim(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+  if (ext == NULL) return 0;
+  if (strcasecmp(ext, ".csv") == 0) return ',';
+  if (strcasecmp(ext, ".tsv") == 0 || strcasecmp(ext, ".tab") == 0) return '\t';
+  return 0;
+}
+
+int editorSplitFields(const char *s, int len, char delim, int *off, int max) {
+  char quote = delim == '\t' ? delim : '"';       //TSV一般不用引号，引号当普通字符
+  int n = 1, inq = 0, i = 0;
+  if (max > 0) off[0] = 0;
+#ifdef __SSE2__
+  __m128i vd = _mm_set1_epi8(delim);
+  __m128i vq = _mm_set1_epi8(quote);
+  for (; i + 16 <= len; i += 16) {                //一次比较16字节，只逐个处理其中的分隔符和引号
+    __m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vd), _mm_cmpeq_epi8(v, vq)));
+    while (mask) {
+      int j = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (s[j] != delim) {
+        inq = !inq;
+      } else if (!inq) {
+        if (n < max) off[n] = j + 1;
+        n++;
+      }
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    if (s[i] == delim) {
+      if (!inq) {
+        if (n < max) off[n] = i + 1;
+        n++;
+      }
+    } else if (s[i] == quote) {
+      inq = !inq;
+    }
+  }
+  if (n < max) off[n] = len + 1;
+  return n;
+}
+
+int editorCellText(const char *s, int len, char delim, char *out, int w) {
+  int quoted = delim != '\t' && len >= 2 && s[0] == '"' && s[len - 1] == '"';
+  int i, end = quoted ? len - 1 : len, n = 0;
+  for (i = quoted; i < end; i++) {                //去掉外层引号，""还原为"
+    if (quoted && s[i] == '"' && i + 1 < end && s[i + 1] == '"') i++;
+    if (out && n < w) out[n] = iscntrl((unsigned char)s[i]) ? ' ' : s[i];
+    n++;
+  }
+  for (i = n; out && i < w; i++) out[i] = ' ';
+  return n;
+}
+
+struct fieldIndex *editorRowFields(int filerow) {
+  if (E.fields == NULL) {
+    int j;
+    E.fields = calloc(TABLE_CACHE, sizeof(struct fieldIndex));
+    if (E.fields == NULL) die("calloc");
+    for (j = 0; j < TABLE_CACHE; j++) E.fields[j].row = -1;
+  }
+  struct fieldIndex *f = &E.fields[filerow % TABLE_CACHE];
+  if (f->row == filerow) return f;
+
+  erow *row = editorFileRow(filerow);
+  int n = editorSplitFields(row->chars, row->size, E.delim, f->off, f->cap);
+  if (n + 1 > f->cap) {                           //字段比缓存项能放的多，扩容后重新切分
+    f->cap = n + 1;
+    f->off = realloc(f->off, sizeof(int) * f->cap);
+    if (f->off == NULL) die("realloc");
+    editorSplitFields(row->chars, row->size, E.delim, f->off, f->cap);
+  }
+  f->row = filerow;
+  f->n = n;
+  editorTableMeasure(row->chars, f->off, n);
+  return f;
+}
+
+void editorTableMeasure(const char *s, const int *off, int n) {
+  if (n > E.colcap) {
+    int cap = E.colcap ? E.colcap : 16;
+    while (cap < n) cap *= 2;
+    E.colw = realloc(E.colw, sizeof(int) * cap);
+    if (E.colw == NULL) die("realloc");
+    E.colcap = cap;
+  }
+  while (E.ncols < n) E.colw[E.ncols++] = 1;
+  int k;
+  for (k = 0; k < n; k++) {
+    int w = editorCellText(&s[off[k]], off[k + 1] - off[k] - 1, E.delim, NULL, 0);
+    if (w > TABLE_MAXW) w = TABLE_MAXW;
+    if (w > E.colw[k]) E.colw[k] = w;
+  }
+}
+
+void editorTableSample() {
+  E.sampled = 1;                                  //前一半取开头的行（通常含表头），后一半均匀分布在已索引的行中
+  int n = editorNumRows(), half = TABLE_SAMPLE / 2, j;
+  for (j = 0; j < TABLE_SAMPLE; j++) {
+    int at = j < half ? j : (int)((int64_t)n * (j - half) / half);
+    if (at < n) editorRowFields(editorViewRow(at));
+  }
+}
+
+void editorTableScroll() {
+  if (!E.sampled) editorTableSample();
+  int at, last = E.rowoff + E.screenrows;
+  if (last > editorNumRows()) last = editorNumRows();
+  for (at = E.rowoff; at < last; at++)            //先切分整屏，列宽在画之前就定下来
+    editorRowFields(editorViewRow(at));
+
+  if (E.tcol >= E.ncols) E.tcol = E.ncols ? E.ncols - 1 : 0;
+  int frozen = E.ncols > TABLE_FROZEN ? TABLE_FROZEN : 0, c, x = 0;
+  for (c = 0; c < frozen; c++) x += E.colw[c] + 1;
+  if (E.tcoloff < frozen) E.tcoloff = frozen;
+  if (E.tcol < frozen) {
+    E.tablecx = 0;
+    for (c = 0; c < E.tcol; c++) E.tablecx += E.colw[c] + 1;
+  } else {
+    if (E.tcol < E.tcoloff) E.tcoloff = E.tcol;
+    int w = x;
+    for (c = E.tcoloff; c <= E.tcol; c++) w += E.colw[c] + 1;
+    while (E.tcoloff < E.tcol && w - 1 > E.screencols) {   //右移直到光标列完整显示
+      w -= E.colw[E.tcoloff] + 1;
+      E.tcoloff++;
+    }
+    E.tablecx = x;
+    for (c = E.tcoloff; c < E.tcol; c++) E.tablecx += E.colw[c] + 1;
+  }
+  if (E.tablecx >= E.screencols) E.tablecx = E.screencols - 1;
+}
+
+void editorDrawTableRows(struct abuf *ab) {
+  int y, c;
+  int frozen = E.ncols > TABLE_FROZEN ? TABLE_FROZEN : 0;
+  char cell[TABLE_MAXW];
+  for (y = 0; y < E.screenrows; y++) {
+    int at = y + E.rowoff;
+    if (at >= editorNumRows()) {
+      abAppend(ab, "~", 1);
+    } else {
+      struct fieldIndex *f = editorRowFields(editorViewRow(at));
+      erow *row = editorRowAt(at);
+      int x = 0;
+      for (c = 0; c < E.ncols && x < E.screencols; c++) {
+        if (c >= frozen && c < E.tcoloff) c = E.tcoloff;   //跳过滚出屏幕的列
+        if (c >= E.ncols) break;
+        int w = E.colw[c];
+        if (w > E.screencols - x) w = E.screencols - x;
+        if (c < f->n)
+          editorCellText(&row->chars[f->off[c]], f->off[c + 1] - f->off[c] - 1, E.delim, cell, w);
+        else
+          memset(cell, ' ', w);                   //字段不够的行补空
+        int cur = at == E.cy && c == E.tcol;
+        if (cur) abAppend(ab, "\x1b[7m", 4);      //反色显示光标所在单元格
+        abAppend(ab, cell, w);
+        if (cur) abAppend(ab, "\x1b[m", 3);
+        x += w;
+        if (x < E.screencols) {
+          abAppend(ab, c == frozen - 1 ? "|" : " ", 1);
+          x++;
+        }
+      }
+    }
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
+int editorTableMoveCursor(int key) {
+  switch (key) {                                  //左右和Home/End按列移动，上下仍按行
+    case ARROW_LEFT:
+      if (E.tcol > 0) E.tcol--;
+      return 1;
+    case ARROW_RIGHT:
+      if (E.tcol < E.ncols - 1) E.tcol++;
+      return 1;
+    case HOME_KEY:
+      E.tcol = 0;
+      return 1;
+    case END_KEY:
+      E.tcol = E.ncols ? E.ncols - 1 : 0;
+      return 1;
+  }
+  return 0;
+}
+
+void editorDiffOpen(char *filename) {
+  struct editorBuffer *a = E.buf, *b = editorNewBuffer();
+  E.buf = b;                                      //借用editorOpen打开右边的文件
+  editorOpen(filename);
+  E.buf = a;
+  E.hex = 0;                                      //比较视图只按行显示
+  E.table = 0;
+  if ((a->map == NULL && a->numrows > 0) || (b->map == NULL && b->numrows > 0)) {
+    editorFreeBuffer(b);                          //比较线程直接读文件映射，管道等无法比较
+    editorSetStatusMessage("Diff needs two regular files, showing %s only", a->filename);
+    return;
+  }
+
+  struct editorDiff *d = calloc(1, sizeof(struct editorDiff));
+  if (d == NULL) die("calloc");
+  d->other = b;
+  d->amap = a->map;
+  d->asize = a->mapsize;
+  d->bmap = b->map;
+  d->bsize = b->mapsize;
+  d->n = d->m = -1;
+  pthread_mutex_init(&d->lock, NULL);
+  E.diff = d;
+  E.cy = 0;
+  E.rowoff = 0;
+
+  pthread_t tid;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&tid, &attr, diffWorker, d) != 0) die("pthread_create");
+  pthread_attr_destroy(&attr);
+  editorSetStatusMessage("HELP: ^Q quit ^N next hunk ^P previous hunk | arrows/PgUp/PgDn scroll");
+}
+
+void *diffWorker(void *arg) {
+  struct editorDiff *d = arg;
+  struct diffSide A = {d->amap, d->asize, 0, 0, NULL, NULL, 0};   //不预先数行数，读到末尾时才知道
+  struct diffSide B = {d->bmap, d->bsize, 0, 0, NULL, NULL, 0};
+
+  struct diffWork w;                              //内存只和窗口大小有关，与文件大小无关
+  int *fdbuf = malloc(sizeof(int) * (2 * DIFF_WINDOW + 3));
+  int *bdbuf = malloc(sizeof(int) * (2 * DIFF_WINDOW + 3));
+  A.h = malloc(sizeof(uint64_t) * DIFF_WINDOW);
+  B.h = malloc(sizeof(uint64_t) * DIFF_WINDOW);
+  A.o = malloc(sizeof(uint64_t) * DIFF_WINDOW);
+  B.o = malloc(sizeof(uint64_t) * DIFF_WINDOW);
+  if (!fdbuf || !bdbuf || !A.h || !B.h || !A.o || !B.o) die("malloc");
+  w.ed = NULL;
+  w.edcap = 0;
+
+  while (1) {
+    int aeof = editorDiffFill(&A);
+    int beof = editorDiffFill(&B);
+    int final = aeof && beof;
+    w.xv = A.h;
+    w.yv = B.h;
+    w.fd = fdbuf + B.len + 1;
+    w.bd = bdbuf + B.len + 1;
+    w.cost = editorDiffCost(A.len + B.len);
+    w.ned = 0;
+    editorDiffCompare(&w, 0, A.len, 0, B.len);
+
+    int commit = w.ned, cx = A.len, cy = B.len;
+    if (!final) {                                 //窗口末尾的结果可能被截断影响，只提交前一半，剩下的放到下个窗口重新比较
+      int ha = A.len / 2, hb = B.len / 2, k;
+      cx = cy = 0;
+      for (k = 0; k < w.ned; k++) {
+        if (w.ed[k].a + w.ed[k].alen > ha || w.ed[k].b + w.ed[k].blen > hb) break;
+        cx = w.ed[k].a + w.ed[k].alen;
+        cy = w.ed[k].b + w.ed[k].blen;
+      }
+      commit = k;
+      int adv = (k < w.ned ? w.ed[k].a : A.len) - cx;   //沿着相同的行前进到下一处差异或窗口的一半
+      if (adv > ha - cx) adv = ha - cx;
+      if (adv > hb - cy) adv = hb - cy;
+      if (adv > 0) {
+        cx += adv;
+        cy += adv;
+      }
+      if (cx == 0 && cy == 0) {                   //第一处差异就超过了一半，只好整个提交，保证向前推进
+        if (w.ned > 0) {
+          commit = 1;
+          cx = w.ed[0].a + w.ed[0].alen;
+          cy = w.ed[0].b + w.ed[0].blen;
+        } else {
+          cx = A.len;
+          cy = B.len;
+        }
+      }
+    }
+
+    int abase = A.next - A.len, bbase = B.next - B.len, k;
+    pthread_mutex_lock(&d->lock);
+    for (k = 0; k < commit; k++)
+      editorDiffAddHunk(d, abase + w.ed[k].a, w.ed[k].alen, bbase + w.ed[k].b, w.ed[k].blen);
+    d->fa = abase + cx;
+    d->fb = bbase + cy;
+    d->abytes = cx < A.len ? A.o[cx] : A.pos;
+    d->bbytes = cy < B.len ? B.o[cy] : B.pos;
+    if (aeof) d->n = A.next;
+    if (beof) d->m = B.next;
+    d->done = final;
+    pthread_mutex_unlock(&d->lock);
+    if (final) break;
+
+    memmove(A.h, A.h + cx, sizeof(uint64_t) * (A.len - cx));
+    memmove(A.o, A.o + cx, sizeof(uint64_t) * (A.len - cx));
+    A.len -= cx;
+    memmove(B.h, B.h + cy, sizeof(uint64_t) * (B.len - cy));
+    memmove(B.o, B.o + cy, sizeof(uint64_t) * (B.len - cy));
+    B.len -= cy;
+  }
+
+  free(fdbuf);
+  free(bdbuf);
+  free(A.h);
+  free(B.h);
+  free(A.o);
+  free(B.o);
+  free(w.ed);
+  return NULL;
+}
+
+uint64_t editorDiffHash(const char *map, uint64_t start, uint64_t end) {
+  while (end > start && (map[end - 1] == '\n' || map[end - 1] == '\r'))
+    end--;
+  return editorHash(&map[start], end - start, HASH_INIT);
+}
+
+int editorDiffFill(struct diffSide *s) {
+  while (s->len < DIFF_WINDOW && s->pos < s->size && s->next < INT_MAX) {   //行数上限与editorIndexStep一致
+    const char *nl = memchr(&s->map[s->pos], '\n', s->size - s->pos);
+    uint64_t end = nl ? (uint64_t)(nl - s->map) + 1 : s->size;
+    s->o[s->len] = s->pos;
+    s->h[s->len++] = editorDiffHash(s->map, s->pos, end);
+    s->pos = end;
+    s->next++;
+  }
+  return s->pos >= s->size || s->next == INT_MAX;
+}
+
+int editorDiffCost(int diags) {
+  int cost = 1;                                   //大约是对角线数的平方根
+  while (diags) {
+    diags >>= 2;
+    cost <<= 1;
+  }
+  return cost < DIFF_MIN_COST ? DIFF_MIN_COST : cost;
+}
+
+void editorDiffSplit(struct diffWork *w, int xoff, int xlim, int yoff, int ylim, int *xmid, int *ymid) {
+  int *fd = w->fd, *bd = w->bd;
+  const uint64_t *xv = w->xv, *yv = w->yv;
+  int dmin = xoff - ylim, dmax = xlim - yoff;     //对角线k=x-y的范围
+  int fmid = xoff - yoff, bmid = xlim - ylim;
+  int fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+  int odd = (fmid - bmid) & 1;                    //奇数时在正向搜索中相遇，偶数时在反向搜索中相遇
+  int c, d;
+  fd[fmid] = xoff;
+  bd[bmid] = xlim;
+  for (c = 1;; c++) {
+    if (fmin > dmin) fd[--fmin - 1] = -1;
+    else fmin++;
+    if (fmax < dmax) fd[++fmax + 1] = -1;
+    else fmax--;
+    for (d = fmax; d >= fmin; d -= 2) {
+      int tlo = fd[d - 1], thi = fd[d + 1];
+      int x = tlo >= thi ? tlo + 1 : thi, y = x - d;
+      while (x < xlim && y < ylim && xv[x] == yv[y]) {
+        x++;
+        y++;
+      }
+      fd[d] = x;
+      if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+        *xmid = x;
+        *ymid = y;
+        return;
+      }
+    }
+
+    if (bmin > dmin) bd[--bmin - 1] = INT_MAX;
+    else bmin++;
+    if (bmax < dmax) bd[++bmax + 1] = INT_MAX;
+    else bmax--;
+    for (d = bmax; d >= bmin; d -= 2) {
+      int tlo = bd[d - 1], thi = bd[d + 1];
+      int x = tlo < thi ? tlo : thi - 1, y = x - d;
+      while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+        x--;
+        y--;
+      }
+      bd[d] = x;
+      if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+        *xmid = x;
+        *ymid = y;
+        return;
+      }
+    }
+
+    if (c >= w->cost) {                           //差异太多：取两个方向中走得最远的点作分割点，结果不一定最短
+      int fxybest = -1, fxbest = xoff, bxybest = INT_MAX, bxbest = xlim;
+      for (d = fmax; d >= fmin; d -= 2) {
+        int x = fd[d] < xlim ? fd[d] : xlim, y = x - d;
+        if (y > ylim) {
+          x = ylim + d;
+          y = ylim;
+        }
+        if (x + y > fxybest) {
+          fxybest = x + y;
+          fxbest = x;
+        }
+      }
+      for (d = bmax; d >= bmin; d -= 2) {
+        int x = bd[d] > xoff ? bd[d] : xoff, y = x - d;
+        if (y < yoff) {
+          x = yoff + d;
+          y = yoff;
+        }
+        if (x + y < bxybest) {
+          bxybest = x + y;
+          bxbest = x;
+        }
+      }
+      if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+        *xmid = fxbest;
+        *ymid = fxybest - fxbest;
+      } else {
+        *xmid = bxbest;
+        *ymid = bxybest - bxbest;
+      }
+      return;
+    }
+  }
+}
+
+void editorDiffCompare(struct diffWork *w, int xoff, int xlim, int yoff, int ylim) {
+  while (xoff < xlim && yoff < ylim && w->xv[xoff] == w->yv[yoff]) {   //相同的前缀和后缀直接按整数比较跳过
+    xoff++;
+    yoff++;
+  }
+  while (xlim > xoff && ylim > yoff && w->xv[xlim - 1] == w->yv[ylim - 1]) {
+    xlim--;
+    ylim--;
+  }
+  if (xoff == xlim || yoff == ylim) {
+    if (xoff < xlim || yoff < ylim) editorDiffEdit(w, xoff, xlim - xoff, yoff, ylim - yoff);
+    return;
+  }
+  int xmid, ymid;
+  editorDiffSplit(w, xoff, xlim, yoff, ylim, &xmid, &ymid);
+  if ((xmid == xoff && ymid == yoff) || (xmid == xlim && ymid == ylim)) {
+    editorDiffEdit(w, xoff, xlim - xoff, yoff, ylim - yoff);   //分割点没有缩小问题时整段当作修改
+    return;
+  }
+  editorDiffCompare(w, xoff, xmid, yoff, ymid);   //先左后右，差异按顺序产生
+  editorDiffCompare(w, xmid, xlim, ymid, ylim);
+}
+
+void editorDiffEdit(struct diffWork *w, int a, int alen, int b, int blen) {
+  struct diffHunk *last = w->ned ? &w->ed[w->ned - 1] : NULL;
+  if (last && last->a + last->alen == a && last->b + last->blen == b) {
+    last->alen += alen;                           //紧挨着上一处差异就合并
+    last->blen += blen;
+    return;
+  }
+  if (w->ned == w->edcap) {
+    w->edcap = w->edcap ? w->edcap * 2 : 256;
+    w->ed = realloc(w->ed, sizeof(struct diffHunk) * w->edcap);
+    if (w->ed == NULL) die("realloc");
+  }
+  w->ed[w->ned].a = a;
+  w->ed[w->ned].alen = alen;
+  w->ed[w->ned].b = b;
+  w->ed[w->ned].blen = blen;
+  w->ned++;
+}
+
+void editorDiffAddHunk(struct editorDiff *d, int a, int alen, int b, int blen) {
+  struct diffHunk *last = d->nhunk ? &d->hunk[d->nhunk - 1] : NULL;
+  if (last && last->a + last->alen == a && last->b + last->blen == b) {
+    last->alen += alen;                           //跨窗口的差异接上
+    last->blen += blen;
+    return;
+  }
+  int pa = 0, pr = 0;
+  if (last) {
+    pa = last->a + last->alen;
+    pr = last->row + (last->alen > last->blen ? last->alen : last->blen);
+  }
+  if (d->nhunk == d->hunkcap) {
+    d->hunkcap = d->hunkcap ? d->hunkcap * 2 : 64;
+    d->hunk = realloc(d->hunk, sizeof(struct diffHunk) * d->hunkcap);
+    if (d->hunk == NULL) die("realloc");
+  }
+  struct diffHunk *h = &d->hunk[d->nhunk++];
+  h->a = a;
+  h->alen = alen;
+  h->b = b;
+  h->blen = blen;
+  h->row = pr + (a - pa);                         //两处差异之间的相同行一一对应
+}
+
+int editorDiffRows() {
+  struct editorDiff *d = E.diff;
+  pthread_mutex_lock(&d->lock);
+  int pa = 0, pb = 0, pr = 0;
+  if (d->nhunk) {
+    struct diffHunk *h = &d->hunk[d->nhunk - 1];
+    pa = h->a + h->alen;
+    pb = h->b + h->blen;
+    pr = h->row + (h->alen > h->blen ? h->alen : h->blen);
+  }
+  int n = d->n >= 0 ? d->n : E.buf->numrows;      //还没数完行数时先用已索引的行数
+  int m = d->m >= 0 ? d->m : d->other->numrows;
+  pthread_mutex_unlock(&d->lock);
+  return pr + (n - pa > m - pb ? n - pa : m - pb);
+}
+
+int editorDiffLine(int r, int *la, int *lb) {
+  struct editorDiff *d = E.diff;
+  pthread_mutex_lock(&d->lock);
+  int lo = 0, hi = d->nhunk;                      //二分查找最后一个从r或r之前开始的差异
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (d->hunk[mid].row <= r) lo = mid + 1;
+    else hi = mid;
+  }
+  int pa = 0, pb = 0, pr = 0, kind;
+  if (lo > 0) {
+    struct diffHunk *h = &d->hunk[lo - 1];
+    int rows = h->alen > h->blen ? h->alen : h->blen;
+    if (r < h->row + rows) {                      //在差异内部，较短的一边补空行
+      int k = r - h->row;
+      *la = k < h->alen ? h->a + k : -1;
+      *lb = k < h->blen ? h->b + k : -1;
+      pthread_mutex_unlock(&d->lock);
+      return DIFF_CHANGED;
+    }
+    pa = h->a + h->alen;
+    pb = h->b + h->blen;
+    pr = h->row + rows;
+  }
+  *la = pa + (r - pr);
+  *lb = pb + (r - pr);
+  kind = *la < d->fa ? DIFF_SAME : DIFF_PENDING;  //还没比较到的部分暂时一一对应显示
+  if (d->n >= 0 && *la >= d->n) *la = -1;
+  if (d->m >= 0 && *lb >= d->m) *lb = -1;
+  pthread_mutex_unlock(&d->lock);
+  return kind;
+}
+
+int editorDiffDone() {
+  pthread_mutex_lock(&E.diff->lock);
+  int done = E.diff->done;
+  pthread_mutex_unlock(&E.diff->lock);
+  return done;
+}
+
+void editorDiffScroll() {
+  int rows = editorDiffRows();
+  if (E.cy > rows - 1) E.cy = rows - 1;
+  if (E.cy < 0) E.cy = 0;
+  if (E.rowoff > rows - E.screenrows) E.rowoff = rows - E.screenrows;
+  if (E.rowoff < 0) E.rowoff = 0;
+  if (E.cy < E.rowoff) E.rowoff = E.cy;
+  if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
+}
+
+void editorDrawDiffRows(struct abuf *ab) {
+  int lw = (E.screencols - 3) / 2;                //左右各占一半，中间3列标记差异
+  if (lw < 0) lw = 0;
+  int rw = E.screencols - 3 - lw;
+  if (rw < 0) rw = 0;
+  E.diff->shown = editorDiffDone();               //先取完成状态再画，避免错过最后一次结果
+  int rows = editorDiffRows(), y;
+  for (y = 0; y < E.screenrows; y++) {
+    int r = y + E.rowoff;
+    if (r >= rows) {
+      abAppend(ab, "~", 1);
+    } else {
+      int la, lb;
+      int kind = editorDiffLine(r, &la, &lb);
+      if (la >= E.buf->numrows || lb >= E.diff->other->numrows)
+        kind = DIFF_PENDING;                      //还没索引到的行先空着，等空闲时的索引追上
+      const char *mark = kind == DIFF_PENDING ? " ? " : kind == DIFF_SAME ? "   " :
+                         la < 0 ? " > " : lb < 0 ? " < " : " | ";
+      editorDiffDrawSide(ab, E.buf, la, lw, kind == DIFF_CHANGED ? "\x1b[31m" : NULL);
+      if (E.screencols >= 3) abAppend(ab, mark, 3);
+      editorDiffDrawSide(ab, E.diff->other, lb, rw, kind == DIFF_CHANGED ? "\x1b[32m" : NULL);
+    }
+    abAppend(ab, "\x1b[K", 3);
+    abAppend(ab, "\r\n", 2);
+  }
+}
+
+void editorDiffDrawSide(struct abuf *ab, struct editorBuffer *b, int line, int width, const char *color) {
+  int len = 0;
+  if (line >= 0 && line < b->numrows) {           //不在这里索引，画界面时不扫描文件
+    struct editorBuffer *save = E.buf;
+    E.buf = b;                                    //载入行按E.buf进行
+    erow *row = editorFileRow(line);
+    len = row->rsize - E.coloff;
+    if (len < 0) len = 0;
+    if (len > width) len = width;
+    if (color && len) abAppend(ab, color, strlen(color));
+    abAppend(ab, &row->render[E.coloff < row->rsize ? E.coloff : row->rsize], len);
+    if (color && len) abAppend(ab, "\x1b[m", 3);
+    E.buf = save;
+  }
+  while (len++ < width) abAppend(ab, " ", 1);
+}
+
+int editorDiffMoveCursor(int key) {
+  switch (key) {
+    case CTRL_KEY('q'):
+      return 0;
+    case ARROW_UP:
+      E.cy--;
+      break;
+    case ARROW_DOWN:
+      E.cy++;                                     //越界的在editorDiffScroll中修正
+      break;
+    case PAGE_UP:
+    case PAGE_DOWN:
+      {
+        int delta = (key == PAGE_UP) ? -E.screenrows : E.screenrows;
+        E.cy += delta;
+        E.rowoff += delta;
+      }
+      break;
+    case HOME_KEY:
+      E.cy = 0;
+      break;
+    case END_KEY:
+      E.cy = editorDiffRows() - 1;
+      break;
+    case ARROW_LEFT:
+      if (E.coloff > 0) E.coloff--;               //左右两边一起横向滚动
+      break;
+    case ARROW_RIGHT:
+      E.coloff++;
+      break;
+    case CTRL_KEY('n'):
+      editorDiffJump(1);
+      break;
+    case CTRL_KEY('p'):
+      editorDiffJump(-1);
+      break;
+    default:
+      editorSetStatusMessage("Diff view is read-only: ^N/^P jump between hunks, ^Q quit");
+      break;
+  }
+  return 1;
+}
+
+void editorDiffJump(int dir) {
+  struct editorDiff *d = E.diff;
+  pthread_mutex_lock(&d->lock);
+  int lo = 0, hi = d->nhunk, target = -1, done = d->done;
+  while (lo < hi) {                               //第一个在光标之后开始的差异
+    int mid = lo + (hi - lo) / 2;
+    if (d->hunk[mid].row <= E.cy) lo = mid + 1;
+    else hi = mid;
+  }
+  if (dir > 0 && lo < d->nhunk) target = d->hunk[lo].row;
+  if (dir < 0) {
+    while (lo > 0 && d->hunk[lo - 1].row >= E.cy) lo--;
+    if (lo > 0) target = d->hunk[lo - 1].row;
+  }
+  pthread_mutex_unlock(&d->lock);
+  if (target < 0) {
+    editorSetStatusMessage(dir > 0 && !done ? "No more hunks yet, still comparing" : "No more hunks");
+    return;
+  }
+  E.cy = target;
+  E.rowoff = E.cy - E.screenrows / 3;             //差异出现在屏幕上方三分之一处，能看到前面几行上下文
+  if (E.rowoff < 0) E.rowoff = 0;
+}
+
+int editorThreads() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) n = 1;
+  if (n > MAX_THREADS) n = MAX_THREADS;
+  return n;
+}
+
+void editorRunWorkers(void *(*fn)(void *), struct rowJob *job, int nt) {
+  pthread_t tid[MAX_THREADS];
+  int created[MAX_THREADS];
+  int t;
+  for (t = 0; t < nt; t++) {
+    created[t] = pthread_create(&tid[t], NULL, fn, &job[t]) == 0;
+    if (!created[t]) fn(&job[t]);                 //建不了线程时在当前线程里做
+  }
+  for (t = 0; t < nt; t++)
+    if (created[t]) pthread_join(tid[t], NULL);
+}
+
+int editorJobTick(struct viewJob *vj, int64_t work) {
+  pthread_mutex_lock(&vj->lock);
+  vj->work += work;
+  int cancel = vj->cancel;
+  pthread_mutex_unlock(&vj->lock);
+  return cancel;
+}
+
+int editorJobStage(struct viewJob *vj, const char *stage, int64_t total) {
+  pthread_mutex_lock(&vj->lock);
+  vj->stage = stage;
+  vj->work = 0;
+  vj->total = total;
+  int cancel = vj->cancel;
+  pthread_mutex_unlock(&vj->lock);
+  return cancel;
+}
+
+void *spanWorker(void *arg) {
+  struct rowJob *job = arg;                       //[from,to)中的行首：没有spans时只数个数，有时从第lines行起写入
+  struct editorBuffer *b = job->rs->buf;
+  uint64_t *out = job->rs->spans;
+  int64_t k = job->lines;
+  uint64_t pos = job->from;
+  while (pos < job->to) {
+    uint64_t stop = job->to - pos > INDEX_CHUNK ? pos + INDEX_CHUNK : job->to;
+    const char *p = &b->map[pos], *end = &b->map[stop];
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+      p++;
+      if ((uint64_t)(p - b->map) == b->mapsize) break;   //文件末尾的换行符后面没有新行
+      if (out) out[k] = p - b->map;
+      k++;
+    }
+    if (editorJobTick(job->vj, stop - pos)) return NULL;
+    pos = stop;
+  }
+  if (out == NULL) job->lines = k;
+  return NULL;
+}
+
+uint64_t *editorBuildSpans(struct viewJob *vj) {
+  struct editorBuffer *b = vj->rs.buf;           //只读文件映射，不用UI线程还在增长的检查点
+  struct rowJob job[MAX_THREADS];
+  int t, nt = editorThreads();
+  if (editorJobStage(vj, "counting lines", (int64_t)b->mapsize * 2)) return NULL;
+  for (t = 0; t < nt; t++) {
+    job[t].rs = &vj->rs;
+    job[t].vj = vj;
+    job[t].from = b->mapsize * t / nt;
+    job[t].to = b->mapsize * (t + 1) / nt;
+    job[t].lines = 0;
+  }
+  editorRunWorkers(spanWorker, job, nt);          //第一遍各段分别数行数
+  if (editorJobTick(vj, 0)) return NULL;
+  int64_t rows = 1;
+  for (t = 0; t < nt; t++) {
+    int64_t count = job[t].lines;
+    job[t].lines = rows;
+    rows += count;
+  }
+  if (rows > INT_MAX) {
+    vj->error = "Too many rows to sort or filter";
+    return NULL;
+  }
+  vj->rs.spans = malloc(sizeof(uint64_t) * (rows + 1));
+  if (vj->rs.spans == NULL) {
+    vj->error = "Out of memory";
+    return NULL;
+  }
+  vj->rs.spans[0] = 0;
+  vj->rs.spans[rows] = b->mapsize;
+  editorRunWorkers(spanWorker, job, nt);          //第二遍按前面各段的行数写入行首
+  if (editorJobTick(vj, 0)) return NULL;
+  vj->rows = rows;
+  vj->spansok = 1;
+  return vj->rs.spans;
+}
+
+const char *editorSpan(struct rowSource *rs, int filerow, int *len) {
+  struct editorBuffer *b = rs->buf;
+  if (rs->spans == NULL) {
+    *len = b->row[filerow].size;
+    return b->row[filerow].chars;
+  }
+  uint64_t start = rs->spans[filerow], end = rs->spans[filerow + 1];
+  while (end > start && (b->map[end - 1] == '\n' || b->map[end - 1] == '\r'))
+    end--;
+  *len = end - start;
+  return &b->map[start];
+}
+
+int editorRowCmp(struct rowSource *rs, int a, int b) {
+  int la, lb;
+  const char *pa = editorSpan(rs, a, &la);
+  const char *pb = editorSpan(rs, b, &lb);
+  int r = memcmp(pa, pb, la < lb ? la : lb);
+  if (r == 0) r = (la > lb) - (la < lb);
+  return rs->desc ? -r : r;
+}
+
+void *sortWorker(void *arg) {
+  struct rowJob *job = arg;                       //自底向上的归并排序，保持相同行的原有顺序
+  int *a = job->src, *b = job->tmp;
+  int width, i, j;
+  int64_t work = 0;
+  for (i = job->lo; i < job->hi; i += 16) {       //先对每16个元素做插入排序
+    int end = i + 16 < job->hi ? i + 16 : job->hi;
+    for (j = i + 1; j < end; j++) {
+      int v = a[j], k = j;
+      while (k > i && editorRowCmp(job->rs, a[k - 1], v) > 0) {
+        a[k] = a[k - 1];
+        k--;
+      }
+      a[k] = v;
+    }
+    if ((work += end - i) >= JOB_TICK) {
+      if (editorJobTick(job->vj, work)) return NULL;
+      work = 0;
+    }
+  }
+  for (width = 16; width < job->hi - job->lo; width *= 2) {
+    for (i = job->lo; i < job->hi; i += 2 * width) {
+      int mid = i + width < job->hi ? i + width : job->hi;
+      int end = mid + width < job->hi ? mid + width : job->hi;
+      int p = i, q = mid, k = i;
+      while (p < mid && q < end) b[k++] = editorRowCmp(job->rs, a[q], a[p]) < 0 ? a[q++] : a[p++];
+      while (p < mid) b[k++] = a[p++];
+      while (q < end) b[k++] = a[q++];
+      if ((work += end - i) >= JOB_TICK) {
+        if (editorJobTick(job->vj, work)) return NULL;
+        work = 0;
+      }
+    }
+    int *swap = a;
+    a = b;
+    b = swap;
+  }
+  editorJobTick(job->vj, work);
+  if (a != job->src)
+    memcpy(&job->src[job->lo], &a[job->lo], sizeof(int) * (job->hi - job->lo));
+  return NULL;
+}
+
+int editorCoRank(struct rowSource *rs, int k, int *a, int m, int *b, int n) {
+  int lo = k > n ? k - n : 0;
+  int hi = k < m ? k : m;
+  while (lo < hi) {                               //相等时a中的元素在前
+    int i = lo + (hi - lo) / 2;
+    int j = k - i;
+    if (i < m && j > 0 && editorRowCmp(rs, a[i], b[j - 1]) <= 0) lo = i + 1;
+    else hi = i;
+  }
+  return lo;
+}
+
+void *mergeWorker(void *arg) {
+  struct rowJob *job = arg;                       //把两段输入合并结果中[lo,hi)这一部分写到dst
+  int *a = &job->src[job->alo], *b = &job->src[job->blo];
+  int m = job->ahi - job->alo, n = job->bhi - job->blo;
+  int i = editorCoRank(job->rs, job->lo, a, m, b, n), j = job->lo - i;
+  int iend = editorCoRank(job->rs, job->hi, a, m, b, n), jend = job->hi - iend;
+  int k = job->alo + job->lo;
+  while (i < iend && j < jend) {
+    job->dst[k++] = editorRowCmp(job->rs, b[j], a[i]) < 0 ? b[j++] : a[i++];
+    if ((k & (JOB_TICK - 1)) == 0 && editorJobTick(job->vj, JOB_TICK)) return NULL;
+  }
+  while (i < iend) job->dst[k++] = a[i++];
+  while (j < jend) job->dst[k++] = b[j++];
+  return NULL;
+}
+
+void editorJobSort(struct viewJob *vj) {
+  int n = vj->n, first = vj->first;
+  int last = vj->last < 0 || vj->last > n ? n : vj->last;
+  vj->last = last;
+  if (last - first < 2) return;                   //没有需要排序的行，result留空
+  int *idx = vj->src;
+  int *tmp = malloc(sizeof(int) * n);
+  if (tmp == NULL) {
+    vj->error = "Out of memory";
+    return;
+  }
+
+  int t, nt = editorThreads();
+  if (nt > (last - first) / 1024) nt = (last - first) / 1024;
+  if (nt < 1) nt = 1;
+  struct rowJob job[MAX_THREADS];
+  int bnd[MAX_THREADS + 1];
+  int64_t total = 0;
+  for (t = 0; t <= nt; t++) bnd[t] = first + (int)((int64_t)(last - first) * t / nt);
+  for (t = 0; t < nt; t++) {                      //进度：插入排序一遍加上每一层归并各一遍
+    int width, len = bnd[t + 1] - bnd[t];
+    for (width = 16, total += len; width < len; width *= 2) total += len;
+  }
+  editorJobStage(vj, "sorting", total);
+  for (t = 0; t < nt; t++) {                      //每个线程先排好自己的一段
+    job[t].rs = &vj->rs;
+    job[t].vj = vj;
+    job[t].src = idx;
+    job[t].tmp = tmp;
+    job[t].lo = bnd[t];
+    job[t].hi = bnd[t + 1];
+  }
+  editorRunWorkers(sortWorker, job, nt);
+
+  int *src = idx, *dst = tmp;
+  int runs = nt, r;
+  int rb[MAX_THREADS + 1];
+  memcpy(rb, bnd, sizeof(bnd));
+  for (total = 0; runs > 1; runs = (runs + 1) / 2) {   //先算出归并要写的元素总数
+    for (r = 0; r + 1 < runs; r += 2) total += rb[r + 2] - rb[r];
+    for (r = 0; r < runs; r += 2) rb[r / 2] = rb[r];
+    rb[(runs + 1) / 2] = rb[runs];
+  }
+  runs = nt;
+  if (runs > 1 && !editorJobStage(vj, "merging", total)) {
+    while (runs > 1) {                            //两两归并，每次归并都按输出位置分给所有线程
+      int nruns = 0;
+      for (r = 0; r < runs; r += 2) {
+        if (r + 1 == runs) {
+          memcpy(&dst[bnd[r]], &src[bnd[r]], sizeof(int) * (bnd[r + 1] - bnd[r]));
+        } else {
+          int len = bnd[r + 2] - bnd[r];
+          for (t = 0; t < nt; t++) {
+            job[t].src = src;
+            job[t].dst = dst;
+            job[t].alo = bnd[r];
+            job[t].ahi = job[t].blo = bnd[r + 1];
+            job[t].bhi = bnd[r + 2];
+            job[t].lo = (int)((int64_t)len * t / nt);
+            job[t].hi = (int)((int64_t)len * (t + 1) / nt);
+          }
+          editorRunWorkers(mergeWorker, job, nt);
+        }
+        bnd[nruns++] = bnd[r];
+      }
+      bnd[nruns] = bnd[runs];
+      runs = nruns;
+      int *swap = src;
+      src = dst;
+      dst = swap;
+      if (editorJobTick(vj, 0)) break;
+    }
+  }
+  if (src != idx) memcpy(&idx[first], &src[first], sizeof(int) * (last - first));
+  free(tmp);
+  if (editorJobTick(vj, 0)) return;
+  vj->result = idx;
+  vj->nresult = n;
+  vj->src = NULL;
+}
+
+void *filterWorker(void *arg) {
+  struct rowJob *job = arg;
+  int j;
+  job->count = 0;
+  for (j = job->lo; j < job->hi; j++) {
+    int filerow = job->src[j], len;
+    const char *p = editorSpan(job->rs, filerow, &len);
+    int match = job->patlen == 0 || memmem(p, len, job->pattern, job->patlen) != NULL;
+    if (match != job->invert) job->dst[job->lo + job->count++] = filerow;
+    if (((j - job->lo + 1) & (JOB_TICK - 1)) == 0 && editorJobTick(job->vj, JOB_TICK)) return NULL;
+  }
+  return NULL;
+}
+
+void editorJobFilter(struct viewJob *vj) {
+  int n = vj->n;
+  int *dst = malloc(sizeof(int) * (n ? n : 1));
+  if (dst == NULL) {
+    vj->error = "Out of memory";
+    return;
+  }
+  int t, nt = editorThreads();
+  struct rowJob job[MAX_THREADS];
+  editorJobStage(vj, "filtering", n);
+  for (t = 0; t < nt; t++) {                      //各线程把结果写在自己那一段，最后按顺序拼接
+    job[t].rs = &vj->rs;
+    job[t].vj = vj;
+    job[t].src = vj->src;
+    job[t].dst = dst;
+    job[t].lo = (int)((int64_t)n * t / nt);
+    job[t].hi = (int)((int64_t)n * (t + 1) / nt);
+    job[t].invert = vj->query[0] == '!';
+    job[t].pattern = vj->query + job[t].invert;
+    job[t].patlen = strlen(job[t].pattern);
+  }
+  editorRunWorkers(filterWorker, job, nt);
+  if (editorJobTick(vj, 0)) {
+    free(dst);
+    return;
+  }
+  int count = 0;
+  for (t = 0; t < nt; t++) {
+    memmove(&dst[count], &dst[job[t].lo], sizeof(int) * job[t].count);
+    count += job[t].count;
+  }
+  vj->result = dst;
+  vj->nresult = count;
+}
+
+void *editorJobWorker(void *arg) {
+  struct viewJob *vj = arg;
+  if (vj->rs.buf->map == NULL || editorBuildSpans(vj)) {   //没有映射时行内容都已在row中
+    if (vj->src == NULL) {                        //按文件顺序的全部行
+      vj->n = vj->rows;
+      vj->src = malloc(sizeof(int) * (vj->n ? vj->n : 1));
+      if (vj->src == NULL) vj->error = "Out of memory";
+      int j;
+      for (j = 0; vj->src && j < vj->n; j++) vj->src[j] = j;
+    }
+    if (vj->src && vj->filter) editorJobFilter(vj);
+    else if (vj->src) editorJobSort(vj);
+  }
+  pthread_mutex_lock(&vj->lock);
+  vj->done = 1;
+  pthread_mutex_unlock(&vj->lock);
+  return NULL;
+}
+
+void editorJobStart(struct viewJob *vj) {
+  vj->rs.buf = E.buf;
+  vj->rows = E.buf->numrows;
+  if (E.view) {                                   //在当前显示的行中继续排序/过滤
+    vj->n = E.nview;
+    vj->src = malloc(sizeof(int) * (E.nview ? E.nview : 1));
+    if (vj->src == NULL) die("malloc");
+    memcpy(vj->src, E.view, sizeof(int) * E.nview);
+  }
+  vj->stage = "starting";
+  pthread_mutex_init(&vj->lock, NULL);
+  E.job = vj;
+  vj->created = pthread_create(&vj->tid, NULL, editorJobWorker, vj) == 0;
+  if (!vj->created) editorJobWorker(vj);
+}
+
+int editorJobPoll() {
+  struct viewJob *vj = E.job;
+  pthread_mutex_lock(&vj->lock);
+  int done = vj->done;
+  pthread_mutex_unlock(&vj->lock);
+  if (!done) return 0;
+  if (vj->created) pthread_join(vj->tid, NULL);
+  E.job = NULL;
+
+  if (vj->cancel) {
+    editorSetStatusMessage("%s cancelled", vj->filter ? "Filter" : "Sort");
+  } else if (vj->error) {
+    editorSetStatusMessage("%s", vj->error);
+  } else {
+    if (vj->spansok && E.buf->indexed < E.buf->mapsize) {
+      editorIndexAdopt(vj->rs.spans, vj->rows);   //已经数出了所有行首，顺便完成索引
+      if (E.anchored) editorScroll();             //按偏移显示的位置现在可以换算成行号
+    }
+    if (vj->result) {
+      free(E.view);
+      E.view = vj->result;
+      E.nview = vj->nresult;
+      E.wraprows = 0;                             //显示顺序变了，换行缓存重新估计
+      E.wrapoff = 0;
+      if (vj->filter) {
+        E.cy = 0;
+        E.cx = 0;
+        E.rowoff = 0;
+        editorSetStatusMessage("%d of %d rows match \"%s\"", vj->nresult, vj->n, vj->query);
+      } else {
+        editorSetStatusMessage("Sorted %d rows%s", vj->last - vj->first, vj->rs.desc ? " (descending)" : "");
+      }
+    } else {
+      editorSetStatusMessage("Nothing to sort");
+    }
+  }
+  free(vj->rs.spans);
+  free(vj->src);
+  free(vj->query);
+  pthread_mutex_destroy(&vj->lock);
+  free(vj);
+  return 1;
+}
+
+void editorJobCancel() {
+  pthread_mutex_lock(&E.job->lock);
+  E.job->cancel = 1;
+  pthread_mutex_unlock(&E.job->lock);
+  editorSetStatusMessage("Cancelling...");
+}
+
+void editorJobStop() {
+  if (E.job == NULL) return;
+  editorJobCancel();
+  if (E.job->created) pthread_join(E.job->tid, NULL);
+  E.job->created = 0;
+  editorJobPoll();
+}
+
+int editorJobBusy() {
+  if (E.job == NULL) return 0;
+  editorSetStatusMessage("A %s is still running (Esc to cancel)", E.job->filter ? "filter" : "sort");
+  return 1;
+}
+
+void editorSortRows() {
+  if (editorJobBusy()) return;
+  char *query = editorPrompt("Sort rows (all or N-M, prefix ! = descending): %s (ESC to cancel)");
+  if (query == NULL) return;
+  struct viewJob *vj = calloc(1, sizeof(struct viewJob));
+  if (vj == NULL) die("calloc");
+  char *q = query;
+  vj->rs.desc = (*q == '!');
+  if (vj->rs.desc) q++;
+  vj->last = -1;
+  if (strcmp(q, "all") != 0 && *q != '\0') {      //范围按显示的行号计算，两端都包含
+    if (sscanf(q, "%d-%d", &vj->first, &vj->last) != 2 || vj->first < 1 || vj->last < vj->first) {
+      editorSetStatusMessage("Bad range: %s", query);
+      free(query);
+      free(vj);
+      return;
+    }
+    vj->first--;
+  }
+  vj->query = query;
+  editorJobStart(vj);                             //在后台排序，完成前照常浏览
+}
+
+void editorFilterRows() {
+  if (editorJobBusy()) return;
+  char *query = editorPrompt("Filter rows containing (prefix ! = not containing): %s (ESC to cancel)");
+  if (query == NULL) return;
+  struct viewJob *vj = calloc(1, sizeof(struct viewJob));
+  if (vj == NULL) die("calloc");
+  vj->filter = 1;
+  vj->query = query;
+  editorJobStart(vj);
+}
+
+void editorResetView() {
+  if (editorJobBusy()) return;
+  if (E.view == NULL) return;
+  if (E.cy < E.nview) E.cy = E.view[E.cy];        //光标留在原来那一行上
+  else E.cy = E.buf->numrows;
+  free(E.view);
+  E.view = NULL;
+  E.nview = 0;
+  E.cx = 0;
+  E.rowoff = E.cy - E.screenrows / 2;
+  if (E.rowoff < 0) E.rowoff = 0;
+  E.wraprows = 0;
+  E.wrapoff = 0;
+  editorSetStatusMessage("Showing all %d rows in file order", E.buf->numrows);
+}
+
+char *editorSocketPath() {
+  static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  const char *dir = getenv("XDG_RUNTIME_DIR");     //优先放在只有当前用户能访问的运行时目录
+  if (dir && *dir)
+    snprintf(path, sizeof(path), "%s/%s", dir, SOCKET_NAME);
+  else
+    snprintf(path, sizeof(path), "/tmp/level3-%d.sock", (int)getuid());
+  return path;
+}
+
+int editorPeerIsUser(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) return 0;
+  return cred.uid == getuid();
+}
+
+void editorServe() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, editorSocketPath(), sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) die("socket");
+  mode_t mask = umask(077);                        //套接字只允许当前用户连接
+  int r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  if (r == -1 && errno == EADDRINUSE) {            //已有同名文件：有服务器在运行就退出，否则是上次遗留的
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fprintf(stderr, "level3 server already running on %s\n", addr.sun_path);
+      exit(1);
+    }
+    if (probe != -1) close(probe);
+    unlink(addr.sun_path);
+    r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  umask(mask);
+  if (r == -1) die("bind");
+  if (listen(fd, 16) == -1) die("listen");
+  signal(SIGPIPE, SIG_IGN);                        //客户端断开时write返回错误而不是结束进程
+  printf("level3 server listening on %s\n", addr.sun_path);
+  fflush(stdout);
+
+  while (1) {
+    int cfd = accept(fd, NULL, NULL);
+    if (cfd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      die("accept");
+    }
+    if (!editorPeerIsUser(cfd)) {                  //不接受其他用户的连接
+      close(cfd);
+      continue;
+    }
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, editorServeClient, (void *)(intptr_t)cfd) != 0)
+      close(cfd);
+    pthread_attr_destroy(&attr);
+  }
+}
+
+void *editorServeClient(void *arg) {
+  memset(&E, 0, sizeof(E));                        //E是线程局部的，每个客户端有自己的光标、视图和窗口大小
+  E.client = 1;
+  E.infd = E.outfd = (int)(intptr_t)arg;
+  initEditor();
+
+  int type, len, rows, cols, n;                    //第一条消息是"行数 列数 文件的绝对路径"
+  char msg[MSG_MAX + 1];
+  if (editorRecvMessage(E.infd, &type, msg, &len) == -1 || type != 'O') editorDetach();
+  msg[len] = '\0';
+  if (sscanf(msg, "%d %d %n", &rows, &cols, &n) != 2) editorDetach();
+  editorSetSize(rows, cols);
+
+  struct editorBuffer *b = editorShareBuffer(&msg[n]);
+  if (b == NULL) {
+    char err[160];
+    int errlen = snprintf(err, sizeof(err), "\x1b[2J\x1b[Hlevel3: %s: %s\r\n", &msg[n], strerror(errno));
+    editorWrite(err, errlen);
+    editorDetach();
+  }
+  E.buf = b;
+  pthread_mutex_lock(&E.buf->lock);
+  E.locked = 1;
+  E.hex = E.buf->binary;
+  E.table = !E.hex && E.buf->delim;
+  E.delim = E.buf->delim;
+  editorSetStatusMessage("HELP: ^Q detach ^G go to ^W wrap ^X hex ^T table ^S sort ^F filter ^R reset");
+
+  while (1) {
+    editorRefreshScreen();
+    editorProcessKeypress();
+  }
+  return NULL;
+}
+
+struct editorBuffer *editorShareBuffer(const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);                   //先确认能打开，避免editorOpen出错
+  if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    if (fd != -1) {
+      close(fd);
+      errno = EINVAL;
+    }
+    return NULL;
+  }
+  close(fd);
+
+  pthread_mutex_lock(&buffers_lock);
+  struct editorBuffer *b = editorFindBuffer(path, &st);
+  pthread_mutex_unlock(&buffers_lock);
+  if (b) return b;
+
+  b = editorNewBuffer();                           //第一次打开：不持有全局锁建立索引，其他客户端照常连接
+  b->clients = 1;                                  //还没放入列表，editorOpen出错时editorDetach会把它释放
+  E.buf = b;
+  editorOpen((char *)path);
+  E.buf = NULL;
+
+  pthread_mutex_lock(&buffers_lock);
+  struct editorBuffer *other = editorFindBuffer(path, &st);
+  if (other == NULL) {                             //放入列表，之后一直常驻
+    b->shared = 1;
+    b->next = buffers;
+    buffers = b;
+  }
+  pthread_mutex_unlock(&buffers_lock);
+  if (other) {                                     //另一个客户端同时打开了同一个文件，用先放入列表的那个
+    editorFreeBuffer(b);
+    return other;
+  }
+  return b;
+}
+
+struct editorBuffer *editorFindBuffer(const char *path, struct stat *st) {
+  struct editorBuffer **p = &buffers, *b;
+  while ((b = *p) != NULL) {
+    if (strcmp(b->filename, path) == 0) {
+      if (b->filestat.st_size == st->st_size && b->filestat.st_mtime == st->st_mtime &&
+          b->filestat.st_ino == st->st_ino && b->filestat.st_dev == st->st_dev) {
+        b->clients++;                              //文件没变，直接复用已建好的索引和渲染结果
+        return b;
+      }
+      *p = b->next;                                //文件已被修改，旧缓冲区移出列表，最后一个客户端断开时释放
+      b->shared = 0;
+      if (b->clients == 0) editorFreeBuffer(b);
+      continue;
+    }
+    p = &b->next;
+  }
+  return NULL;
+}
+
+void editorDetach() {
+  editorJobStop();                                 //后台线程还在读缓冲区，先让它结束
+  struct editorBuffer *b = E.buf;
+  if (b) {
+    if (E.locked) pthread_mutex_unlock(&b->lock);
+    pthread_mutex_lock(&buffers_lock);
+    int idle = --b->clients == 0 && !b->shared;
+    pthread_mutex_unlock(&buffers_lock);
+    if (idle) editorFreeBuffer(b);                 //已经移出列表的旧缓冲区没人用了
+  }
+  close(E.infd);
+  free(E.view);
+  free(E.wrapcnt);
+  free(E.wrapgen);
+  free(E.fen);
+  free(E.colw);
+  int j;
+  if (E.fields)
+    for (j = 0; j < TABLE_CACHE; j++) free(E.fields[j].off);
+  free(E.fields);
+  for (j = 0; j < E.framerows; j++) abFree(&E.frame[j]);
+  free(E.frame);
+  pthread_exit(NULL);
+}
+
+void editorFrameDiff(struct abuf *out, struct abuf *frame) {
+  int rows = E.screenrows + 2;                     //文本行加状态栏和消息栏
+  if (E.frame == NULL) {
+    E.frame = calloc(rows, sizeof(struct abuf));
+    if (E.frame == NULL) die("calloc");
+    E.framerows = rows;
+  }
+  int y = 0, pos = 0;
+  while (y < E.framerows && pos <= frame->len) {
+    char *end = frame->len > pos ? memmem(&frame->b[pos], frame->len - pos, "\r\n", 2) : NULL;
+    int len = end ? end - &frame->b[pos] : frame->len - pos;
+    struct abuf *old = &E.frame[y];
+    if (old->b == NULL || old->len != len || memcmp(old->b, &frame->b[pos], len) != 0) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+      abAppend(out, buf, strlen(buf));
+      abAppend(out, &frame->b[pos], len);
+      free(old->b);                                //空行也要分配，b为NULL表示还没发送过
+      old->b = malloc(len + 1);
+      if (old->b == NULL) die("malloc");
+      memcpy(old->b, &frame->b[pos], len);
+      old->len = len;
+    }
+    y++;
+    if (end == NULL) break;
+    pos += len + 2;
+  }
+}
+
+int editorSendMessage(int fd, int type, const char *data, int len) {
+  char msg[MSG_MAX + 3];                           //消息格式：类型1字节，长度2字节（大端），然后是内容
+  if (len > MSG_MAX) return -1;
+  msg[0] = type;
+  msg[1] = (len >> 8) & 0xff;
+  msg[2] = len & 0xff;
+  memcpy(&msg[3], data, len);
+  char *p = msg;
+  len += 3;
+  while (len > 0) {                                //处理只写了一部分的情况
+    ssize_t n = write(fd, p, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int editorRecvMessage(int fd, int *type, char *data, int *len) {
+  unsigned char hdr[3];
+  int got = 0, want = 3;
+  char *dst = (char *)hdr;
+  while (1) {                                      //先读消息头，再按长度读内容
+    while (got < want) {
+      ssize_t n = read(fd, dst + got, want - got);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return -1;
+      got += n;
+    }
+    if (dst != (char *)hdr) break;
+    *type = hdr[0];
+    *len = (hdr[1] << 8) | hdr[2];
+    if (*len > MSG_MAX) return -1;
+    dst = data;
+    got = 0;
+    want = *len;
+  }
+  return 0;
+}
+
+int editorAttach(char *filename) {
+  char *path = realpath(filename, NULL);          //服务器按绝对路径区分缓冲区
+  if (path == NULL) return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, editorSocketPath(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (fd != -1) close(fd);
+    free(path);
+    return -1;
+  }
+  if (!editorPeerIsUser(fd)) {                     //没有XDG_RUNTIME_DIR时路径在/tmp下，可能被别人抢先创建，按键不能发给它
+    close(fd);
+    free(path);
+    return -2;
+  }
+
+  int rows, cols;
+  if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+  char msg[MSG_MAX];
+  int len = snprintf(msg, sizeof(msg), "%d %d %s", rows, cols, path);
+  free(path);
+  if (len >= MSG_MAX || editorSendMessage(fd, 'O', msg, len) == -1) die("attach");
+
+  struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+  while (1) {                                      //只负责转发：按键发给服务器，画面原样写到终端
+    if (poll(pfd, 2, -1) == -1) {
+      if (errno != EINTR) die("poll");
+      if (winchanged) {
+        winchanged = 0;
+        if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+        len = snprintf(msg, sizeof(msg), "%d %d", rows, cols);
+        if (editorSendMessage(fd, 'W', msg, len) == -1) exit(0);
+      }
+      continue;
+    }
+    if (pfd[0].revents & POLLIN) {
+      len = read(STDIN_FILENO, msg, sizeof(msg));
+      if (len <= 0 || editorSendMessage(fd, 'K', msg, len) == -1) exit(0);
+    }
+    if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      len = read(fd, msg, sizeof(msg));
+      if (len <= 0) exit(0);                       //服务器断开了这个客户端（Ctrl-Q）
+      if (write(STDOUT_FILENO, msg, len) != len) exit(1);
+    }
+  }
+}